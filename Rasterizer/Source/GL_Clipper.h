@@ -0,0 +1,168 @@
+#pragma once
+
+#include "..\Utils\geometry.h"
+
+// vertex of a clipped polygon.
+// Position is homogeneous screen position (X, Y, Z, W): viewport*projection*modelview*vertex, not divided by W yet.
+// Weights are its barycentric coordinates in the original triangle: clipping is linear in homogeneous space, so
+// varyings of a new vertex are the corners' varyings weighted by them.
+struct ClipVertex
+{
+	float Position[4];
+	Vec3f Weights;
+};
+
+// Clips triangles in homogeneous screen space, between vertex stage and triangle setup, so a vertex at or behind the
+// eye is never divided by its w and off-screen geometry never reaches the rasterizer.
+// planes are
+//   near: W >= NearW, just in front of the eye.
+//   far: Z >= 0, back of the viewport's depth range (larger z is closer).
+//   guard band: X and Y within GuardBand pixels outside the screen.
+// a triangle with all vertices outside one of near, far or the screen edges is rejected without clipping.
+// a triangle which only crosses the screen edges but stays in the guard band is not clipped, the rasterizer's
+// bounding box clamping handles it. only triangles crossing near, far or the guard band are cut,
+// which is rare, so almost every triangle goes through untouched and renders exactly as before.
+class Clipper
+{
+public:
+	enum class EResult { Inside, Outside, Clipped };
+
+	// clipping against all 6 planes adds at most one vertex per plane.
+	static const int MaxVertices = 9;
+	static const int MaxTriangles = MaxVertices - 2;
+
+	Clipper(int InWidth, int InHeight, float InGuardBand = 1024.f, float InNearW = 1e-3f) :
+		Width((float)InWidth), Height((float)InHeight), GuardBand(InGuardBand), NearW(InNearW) {}
+
+	// whether triangle of the 3 homogeneous positions can be drawn as is, is not visible at all, or needs Clip.
+	EResult Classify(const Mat41* InPositions) const
+	{
+		unsigned ScreenOut[3], GuardOut[3];
+		for (int i = 0; i < 3; i++)
+		{
+			Outcodes(InPositions[i], ScreenOut[i], GuardOut[i]);
+		}
+
+		if (ScreenOut[0] & ScreenOut[1] & ScreenOut[2])
+		{
+			return EResult::Outside;
+		}
+		return (GuardOut[0] | GuardOut[1] | GuardOut[2]) ? EResult::Clipped : EResult::Inside;
+	}
+
+	// Sutherland-Hodgman clipping of the triangle against the planes it crosses.
+	// returns vertex count of the convex polygon left in OutPolygon (fan of triangles 0, i, i+1), 0 when nothing is left.
+	int Clip(const Mat41* InPositions, ClipVertex* OutPolygon) const
+	{
+		ClipVertex Buffer[2][MaxVertices];
+		unsigned Crossed = 0;
+		for (int i = 0; i < 3; i++)
+		{
+			unsigned ScreenOut, GuardOut;
+			Outcodes(InPositions[i], ScreenOut, GuardOut);
+			Crossed |= GuardOut;
+
+			for (int k = 0; k < 4; k++)
+			{
+				Buffer[0][i].Position[k] = InPositions[i][k][0];
+			}
+			Buffer[0][i].Weights = Vec3f(i == 0, i == 1, i == 2);
+		}
+
+		int Count = 3;
+		int Current = 0;
+		for (int Plane = 0; Plane < NumPlanes && Count > 0; Plane++)
+		{
+			if (!(Crossed & (1u << Plane)))
+			{
+				continue;
+			}
+			Count = ClipPolygon(Plane, Buffer[Current], Count, Buffer[1 - Current]);
+			Current = 1 - Current;
+		}
+
+		if (Count < 3)
+		{
+			return 0;
+		}
+		for (int i = 0; i < Count; i++)
+		{
+			OutPolygon[i] = Buffer[Current][i];
+		}
+		return Count;
+	}
+
+	// screen position of a clipped vertex, W > 0 after clipping.
+	static Vec3f ToScreen(const ClipVertex& InVertex)
+	{
+		return Vec3f(InVertex.Position[0] / InVertex.Position[3], InVertex.Position[1] / InVertex.Position[3], InVertex.Position[2] / InVertex.Position[3]);
+	}
+
+private:
+	enum { PlaneNear, PlaneFar, PlaneLeft, PlaneRight, PlaneBottom, PlaneTop, NumPlanes };
+
+	// signed distance of P to plane, >= 0 is inside. InMargin moves the x/y planes out by that many pixels.
+	float Distance(int InPlane, const float* P, float InMargin) const
+	{
+		switch (InPlane)
+		{
+		case PlaneNear: return P[3] - NearW;
+		case PlaneFar: return P[2];
+		case PlaneLeft: return P[0] + InMargin*P[3];
+		case PlaneRight: return (Width + InMargin)*P[3] - P[0];
+		case PlaneBottom: return P[1] + InMargin*P[3];
+		default: return (Height + InMargin)*P[3] - P[1];
+		}
+	}
+
+	// bit per plane: ScreenOut for outside of near/far/screen edges, GuardOut for outside of near/far/guard band.
+	void Outcodes(const Mat41& InPosition, unsigned& OutScreenOut, unsigned& OutGuardOut) const
+	{
+		const float P[4] = { InPosition[0][0], InPosition[1][0], InPosition[2][0], InPosition[3][0] };
+		OutScreenOut = OutGuardOut = 0;
+		for (int Plane = 0; Plane < NumPlanes; Plane++)
+		{
+			OutScreenOut |= (Distance(Plane, P, 0.f) < 0) << Plane;
+			OutGuardOut |= (Distance(Plane, P, GuardBand) < 0) << Plane;
+		}
+	}
+
+	int ClipPolygon(int InPlane, const ClipVertex* InPolygon, int InCount, ClipVertex* OutPolygon) const
+	{
+		int OutCount = 0;
+		for (int i = 0; i < InCount; i++)
+		{
+			const ClipVertex& From = InPolygon[i];
+			const ClipVertex& To = InPolygon[(i + 1) % InCount];
+			const float DFrom = Distance(InPlane, From.Position, GuardBand);
+			const float DTo = Distance(InPlane, To.Position, GuardBand);
+
+			if (DFrom >= 0)
+			{
+				OutPolygon[OutCount++] = From;
+			}
+			if ((DFrom >= 0) != (DTo >= 0))
+			{
+				// always interpolate from the inside vertex, so an edge shared by two triangles is cut at the same point.
+				const ClipVertex& In = DFrom >= 0 ? From : To;
+				const ClipVertex& Out = DFrom >= 0 ? To : From;
+				const float DIn = DFrom >= 0 ? DFrom : DTo;
+				const float DOut = DFrom >= 0 ? DTo : DFrom;
+				const float T = DIn / (DIn - DOut);
+
+				ClipVertex& New = OutPolygon[OutCount++];
+				for (int k = 0; k < 4; k++)
+				{
+					New.Position[k] = In.Position[k] + (Out.Position[k] - In.Position[k])*T;
+				}
+				New.Weights = In.Weights + (Out.Weights - In.Weights)*T;
+			}
+		}
+		return OutCount;
+	}
+
+	float Width;
+	float Height;
+	float GuardBand;
+	float NearW;
+};
@@ -0,0 +1,291 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "..\Utils\tgaimage.h"
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+enum class EFrameFormat
+{
+	Tga,		// <BaseName><frame>.tga, uncompressed
+	TgaRle,		// <BaseName><frame>.tga, rle compressed
+	Ppm,		// <BaseName><frame>.ppm, binary P6 (P5 for gray images)
+	PpmStream,	// binary ppm frames one after the other on stdout, e.g. for ffmpeg -f image2pipe -i -
+	RawStream	// bare rgb24 (gray8) frames one after the other on stdout, e.g. for ffmpeg -f rawvideo
+};
+
+// Output stage of an image sequence: rendered frames are handed over with Submit, then flipped, encoded and written
+// on background threads while the caller renders the next frame.
+// Submit copies the image into one of InQueueSize slots and returns at once, it only blocks when all slots are
+// still waiting or being written, which bounds the memory and the frames in flight when writing is the slower part.
+// slots keep their images from frame to frame, a sequence of same sized frames allocates nothing after the first ones.
+// files are written in any order by InNumThreads threads, streams are always written in frame order.
+// InNumThreads = 0 writes every frame inside Submit on the calling thread, like writing the image directly.
+class FrameWriter
+{
+public:
+	FrameWriter(const std::string& InBaseName, EFrameFormat InFormat = EFrameFormat::Tga, int InQueueSize = 3, int InNumThreads = 1) :
+		BaseName(InBaseName), Format(InFormat), Slots(std::max(1, InQueueSize)), NextFrame(0), NextToWrite(0), InFlight(0), NumFailed(0), bQuit(false)
+	{
+		for (int Index = (int)Slots.size() - 1; Index >= 0; Index--)
+		{
+			FreeSlots.push_back(Index);
+		}
+#ifdef _WIN32
+		if (IsStream())
+		{
+			_setmode(_fileno(stdout), _O_BINARY);
+		}
+#endif
+		for (int Index = 0; Index < InNumThreads; Index++)
+		{
+			Workers.emplace_back([this]() { WorkerLoop(); });
+		}
+	}
+
+	~FrameWriter()
+	{
+		Flush();
+		{
+			std::unique_lock<std::mutex> Lock(Mutex);
+			bQuit = true;
+		}
+		WorkCondition.notify_all();
+		for (std::thread& Worker : Workers)
+		{
+			Worker.join();
+		}
+	}
+
+	FrameWriter(const FrameWriter&) = delete;
+	FrameWriter& operator=(const FrameWriter&) = delete;
+
+	// queue a copy of InImage, as rendered (origin at the bottom left), as the next frame. returns its frame number.
+	// safe to call from several threads: frames are numbered in the order their copies are queued, never before,
+	// so pending frames stay in frame order and a stream worker never waits for a frame queued after its own.
+	int Submit(const TGAImage& InImage)
+	{
+		int SlotIndex, Frame;
+		{
+			std::unique_lock<std::mutex> Lock(Mutex);
+			DoneCondition.wait(Lock, [this]() { return !FreeSlots.empty(); });
+			SlotIndex = FreeSlots.back();
+			FreeSlots.pop_back();
+			InFlight++;
+		}
+
+		// the slot belongs to this thread until it is queued.
+		// copied into the slot's buffer, which fits every frame as large as one before.
+		FrameSlot& Slot = Slots[SlotIndex];
+		Slot.Image = InImage;
+
+		{
+			std::unique_lock<std::mutex> Lock(Mutex);
+			Frame = NextFrame++;
+			Slot.Frame = Frame;
+			if (!Workers.empty())
+			{
+				Pending.push_back(SlotIndex);
+			}
+		}
+
+		if (Workers.empty())
+		{
+			WriteSlot(SlotIndex);
+			return Frame;
+		}
+		WorkCondition.notify_one();
+		return Frame;
+	}
+
+	// wait until every frame submitted so far is written.
+	void Flush()
+	{
+		std::unique_lock<std::mutex> Lock(Mutex);
+		DoneCondition.wait(Lock, [this]() { return InFlight == 0; });
+		if (IsStream())
+		{
+			fflush(stdout);
+		}
+	}
+
+	int NumFrames()
+	{
+		std::unique_lock<std::mutex> Lock(Mutex);
+		return NextFrame;
+	}
+
+	// frames whose file could not be written or whose stream write failed.
+	int NumFailedFrames()
+	{
+		std::unique_lock<std::mutex> Lock(Mutex);
+		return NumFailed;
+	}
+
+	// <BaseName><InFrame>.<extension> of file formats.
+	std::string FileName(int InFrame) const
+	{
+		return BaseName + std::to_string(InFrame) + (Format == EFrameFormat::Ppm ? ".ppm" : ".tga");
+	}
+
+	// binary ppm of InImage, rows top down as stored (an image flipped after rendering).
+	static void EncodePpm(const TGAImage& InImage, std::vector<unsigned char>& OutBytes)
+	{
+		OutBytes.clear();
+		const bool bGray = InImage.get_bytespp() == TGAImage::GRAYSCALE;
+		const std::string Header = std::string(bGray ? "P5\n" : "P6\n") + std::to_string(InImage.get_width()) + " " + std::to_string(InImage.get_height()) + "\n255\n";
+		OutBytes.insert(OutBytes.end(), Header.begin(), Header.end());
+		EncodeRaw(InImage, OutBytes);
+	}
+
+	// rows of InImage top down as stored, gray8 or rgb24 (alpha dropped), appended to OutBytes.
+	static void EncodeRaw(const TGAImage& InImage, std::vector<unsigned char>& OutBytes)
+	{
+		const int Width = InImage.get_width(), Height = InImage.get_height(), BytesPP = InImage.get_bytespp();
+		if (!InImage.buffer())
+		{
+			return;
+		}
+
+		const int Channels = BytesPP == TGAImage::GRAYSCALE ? 1 : 3;
+		size_t Out = OutBytes.size();
+		OutBytes.resize(Out + (size_t)Width*Height*Channels);
+		for (int Y = 0; Y < Height; Y++)
+		{
+			const unsigned char* Row = InImage.row(Y);
+			if (Channels == 1)
+			{
+				memcpy(&OutBytes[Out], Row, Width);
+				Out += Width;
+				continue;
+			}
+			// tga stores bgr(a).
+			for (int X = 0; X < Width; X++, Row += BytesPP, Out += 3)
+			{
+				OutBytes[Out] = Row[2];
+				OutBytes[Out + 1] = Row[1];
+				OutBytes[Out + 2] = Row[0];
+			}
+		}
+	}
+
+private:
+	struct FrameSlot
+	{
+		TGAImage Image;
+		int Frame = 0;
+		// encoded stream frame, kept for its capacity.
+		std::vector<unsigned char> Bytes;
+	};
+
+	bool IsStream() const
+	{
+		return Format == EFrameFormat::PpmStream || Format == EFrameFormat::RawStream;
+	}
+
+	void WorkerLoop()
+	{
+		for (;;)
+		{
+			int SlotIndex;
+			{
+				std::unique_lock<std::mutex> Lock(Mutex);
+				WorkCondition.wait(Lock, [this]() { return bQuit || !Pending.empty(); });
+				if (Pending.empty())
+				{
+					return;
+				}
+				SlotIndex = Pending.front();
+				Pending.pop_front();
+			}
+			WriteSlot(SlotIndex);
+		}
+	}
+
+	// flip, encode and write the frame in slot SlotIndex, then hand the slot back.
+	void WriteSlot(int SlotIndex)
+	{
+		FrameSlot& Slot = Slots[SlotIndex];
+		Slot.Image.flip_vertically();
+
+		bool bWritten;
+		if (IsStream())
+		{
+			// encoding runs in parallel, only the writes wait for the frames before.
+			Slot.Bytes.clear();
+			if (Format == EFrameFormat::PpmStream)
+			{
+				EncodePpm(Slot.Image, Slot.Bytes);
+			}
+			else
+			{
+				EncodeRaw(Slot.Image, Slot.Bytes);
+			}
+			{
+				std::unique_lock<std::mutex> Lock(Mutex);
+				DoneCondition.wait(Lock, [&]() { return NextToWrite == Slot.Frame; });
+			}
+			bWritten = fwrite(Slot.Bytes.data(), 1, Slot.Bytes.size(), stdout) == Slot.Bytes.size();
+		}
+		else if (Format == EFrameFormat::Ppm)
+		{
+			EncodePpm(Slot.Image, Slot.Bytes);
+			FILE* File = fopen(FileName(Slot.Frame).c_str(), "wb");
+			bWritten = File && fwrite(Slot.Bytes.data(), 1, Slot.Bytes.size(), File) == Slot.Bytes.size();
+			if (File)
+			{
+				bWritten = fclose(File) == 0 && bWritten;
+			}
+		}
+		else
+		{
+			bWritten = Slot.Image.write_tga_file(FileName(Slot.Frame).c_str(), Format == EFrameFormat::TgaRle);
+		}
+
+		{
+			std::unique_lock<std::mutex> Lock(Mutex);
+			if (IsStream())
+			{
+				NextToWrite++;
+			}
+			if (!bWritten)
+			{
+				NumFailed++;
+			}
+			FreeSlots.push_back(SlotIndex);
+			InFlight--;
+		}
+		DoneCondition.notify_all();
+	}
+
+	std::string BaseName;
+	EFrameFormat Format;
+
+	std::vector<FrameSlot> Slots;
+	std::vector<int> FreeSlots;
+	// slots submitted and not taken by a worker yet, in frame order (numbered when pushed).
+	std::deque<int> Pending;
+
+	std::vector<std::thread> Workers;
+	std::mutex Mutex;
+	// new pending frame or quit.
+	std::condition_variable WorkCondition;
+	// a frame is written: a slot is free, the next stream frame may go, Flush may be done.
+	std::condition_variable DoneCondition;
+
+	int NextFrame;
+	int NextToWrite;
+	int InFlight;
+	int NumFailed;
+	bool bQuit;
+};
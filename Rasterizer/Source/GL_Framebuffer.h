@@ -0,0 +1,246 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <new>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "..\Utils\tgaimage.h"
+#include "GL_RasterKernel.h"
+
+// Aligned memory blocks for framebuffer attachments, kept after use and handed out again.
+// a render that creates its buffers every frame then only touches memory that is already mapped,
+// instead of asking the allocator for (and page faulting in) megabytes per frame.
+// thread safe, framebuffers of concurrent renders can share one pool.
+class AttachmentPool
+{
+public:
+	// start of every block, a multiple of the cache line size and of the widest SIMD register.
+	static const size_t Alignment = 64;
+
+	// the pool framebuffers use by default.
+	static AttachmentPool& Get()
+	{
+		static AttachmentPool Pool;
+		return Pool;
+	}
+
+	AttachmentPool() {}
+	AttachmentPool(const AttachmentPool&) = delete;
+	AttachmentPool& operator=(const AttachmentPool&) = delete;
+
+	~AttachmentPool()
+	{
+		Trim();
+	}
+
+	// a block of at least InBytes bytes, the smallest free one that fits, or a new one.
+	// OutCapacity gets its real size, which must be given back to Release.
+	void* Acquire(size_t InBytes, size_t& OutCapacity)
+	{
+		{
+			std::unique_lock<std::mutex> Lock(Mutex);
+			int Best = -1;
+			for (int Index = 0; Index < (int)FreeBlocks.size(); Index++)
+			{
+				if (FreeBlocks[Index].Capacity >= InBytes && (Best < 0 || FreeBlocks[Index].Capacity < FreeBlocks[Best].Capacity))
+				{
+					Best = Index;
+				}
+			}
+			if (Best >= 0)
+			{
+				Block Found = FreeBlocks[Best];
+				FreeBlocks.erase(FreeBlocks.begin() + Best);
+				OutCapacity = Found.Capacity;
+				return Found.Data;
+			}
+		}
+
+		OutCapacity = InBytes;
+		return AllocateAligned(InBytes);
+	}
+
+	void Release(void* InData, size_t InCapacity)
+	{
+		if (!InData)
+		{
+			return;
+		}
+		std::unique_lock<std::mutex> Lock(Mutex);
+		FreeBlocks.push_back(Block{ InData, InCapacity });
+	}
+
+	// free all blocks not in use.
+	void Trim()
+	{
+		std::unique_lock<std::mutex> Lock(Mutex);
+		for (const Block& Free : FreeBlocks)
+		{
+			FreeAligned(Free.Data);
+		}
+		FreeBlocks.clear();
+	}
+
+	size_t FreeBytes()
+	{
+		std::unique_lock<std::mutex> Lock(Mutex);
+		size_t Bytes = 0;
+		for (const Block& Free : FreeBlocks)
+		{
+			Bytes += Free.Capacity;
+		}
+		return Bytes;
+	}
+
+private:
+	struct Block
+	{
+		void* Data;
+		size_t Capacity;
+	};
+
+	// over-allocate and keep the address operator new returned just in front of the aligned block.
+	static void* AllocateAligned(size_t InBytes)
+	{
+		unsigned char* Raw = static_cast<unsigned char*>(::operator new(InBytes + Alignment + sizeof(void*)));
+		uintptr_t Aligned = ((uintptr_t)(Raw + sizeof(void*)) + Alignment - 1) & ~(uintptr_t)(Alignment - 1);
+		reinterpret_cast<void**>(Aligned)[-1] = Raw;
+		return reinterpret_cast<void*>(Aligned);
+	}
+
+	static void FreeAligned(void* InData)
+	{
+		::operator delete(reinterpret_cast<void**>(InData)[-1]);
+	}
+
+	std::mutex Mutex;
+	std::vector<Block> FreeBlocks;
+};
+
+// Render target of one view: a color image, its z buffer and optionally the z buffer and depth image of a shadow pass.
+// z buffers come from an AttachmentPool and are 64 byte aligned, so rows of the rasterizer's tiles start on cache lines.
+// a framebuffer is meant to live as long as the renders drawing into it: Clear at the start of every frame resets
+// all attachments in place with SIMD stores, no memory is allocated or freed from frame to frame.
+// larger z is closer, z buffers are cleared to -FLT_MAX (farthest).
+class Framebuffer
+{
+public:
+	Framebuffer(int InWidth, int InHeight, int InBytesPP = TGAImage::RGB, bool bInShadow = false, AttachmentPool& InPool = AttachmentPool::Get()) :
+		Pool(InPool), Width(0), Height(0), BytesPP(InBytesPP), bShadow(bInShadow), ZBuffer(nullptr), ZCapacity(0), ShadowBuffer(nullptr), ShadowCapacity(0)
+	{
+		Resize(InWidth, InHeight);
+	}
+
+	Framebuffer(const Framebuffer&) = delete;
+	Framebuffer& operator=(const Framebuffer&) = delete;
+
+	~Framebuffer()
+	{
+		Pool.Release(ZBuffer, ZCapacity);
+		Pool.Release(ShadowBuffer, ShadowCapacity);
+	}
+
+	// attachments keep their memory when the new size fits in it. everything is cleared.
+	void Resize(int InWidth, int InHeight)
+	{
+		if (InWidth == Width && InHeight == Height)
+		{
+			Clear();
+			return;
+		}
+
+		// TGAImage::resize leaves the images black, only the z buffers need clearing.
+		Width = InWidth;
+		Height = InHeight;
+		ColorImage.resize(Width, Height, BytesPP);
+		Reserve(ZBuffer, ZCapacity);
+		ClearDepth(ZBuffer, Width*Height);
+		if (bShadow)
+		{
+			ShadowImage.resize(Width, Height, TGAImage::RGB);
+			Reserve(ShadowBuffer, ShadowCapacity);
+			ClearDepth(ShadowBuffer, Width*Height);
+		}
+	}
+
+	// start of a frame: black color, all depths farthest.
+	void Clear()
+	{
+		ColorImage.clear();
+		ClearDepth(ZBuffer, Width*Height);
+		if (bShadow)
+		{
+			ShadowImage.clear();
+			ClearDepth(ShadowBuffer, Width*Height);
+		}
+	}
+
+	int GetWidth() const { return Width; }
+	int GetHeight() const { return Height; }
+	bool HasShadow() const { return bShadow; }
+
+	TGAImage& Color() { return ColorImage; }
+	float* Depth() { return ZBuffer; }
+	// shadow attachments, nullptr/empty without bInShadow.
+	TGAImage& ShadowColor() { return ShadowImage; }
+	float* ShadowDepth() { return ShadowBuffer; }
+
+	// fill InCount floats from 64 byte aligned InData with farthest depth.
+	static void ClearDepth(float* InData, int InCount)
+	{
+		const float Farthest = -std::numeric_limits<float>::max();
+		int Index = 0;
+#if GL_RASTER_X86
+		if (RasterKernel::GetLevel() != RasterKernel::ELevel::Scalar)
+		{
+			Index = ClearDepthSSE2(InData, InCount, Farthest);
+		}
+#endif
+		std::fill(InData + Index, InData + InCount, Farthest);
+	}
+
+private:
+	void Reserve(float*& InOutData, size_t& InOutCapacity)
+	{
+		const size_t Bytes = (size_t)Width*Height*sizeof(float);
+		if (Bytes > InOutCapacity)
+		{
+			Pool.Release(InOutData, InOutCapacity);
+			InOutData = static_cast<float*>(Pool.Acquire(Bytes, InOutCapacity));
+		}
+	}
+
+#if GL_RASTER_X86
+	// one cache line per iteration, returns the number of floats written.
+	GL_TARGET_SSE2 static int ClearDepthSSE2(float* InData, int InCount, float InValue)
+	{
+		const __m128 Value = _mm_set1_ps(InValue);
+		int Index = 0;
+		for (; Index + 16 <= InCount; Index += 16)
+		{
+			_mm_store_ps(InData + Index, Value);
+			_mm_store_ps(InData + Index + 4, Value);
+			_mm_store_ps(InData + Index + 8, Value);
+			_mm_store_ps(InData + Index + 12, Value);
+		}
+		return Index;
+	}
+#endif
+
+	AttachmentPool& Pool;
+	int Width;
+	int Height;
+	int BytesPP;
+	bool bShadow;
+
+	TGAImage ColorImage;
+	float* ZBuffer;
+	size_t ZCapacity;
+
+	TGAImage ShadowImage;
+	float* ShadowBuffer;
+	size_t ShadowCapacity;
+};
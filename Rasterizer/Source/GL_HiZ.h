@@ -0,0 +1,100 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Hierarchical z of a z buffer region: farthest (MinZ) and nearest (MaxZ) depth of every 8x8 cell of pixels.
+// larger z is closer and a pixel is drawn when its z >= z buffer, so a triangle whose depth over a cell stays below
+// the cell's MinZ can't change any pixel of it, and the cell (or the whole triangle) is skipped before per pixel work.
+// MaxZ follows every write. when the farthest pixel of a cell is overwritten, MinZ is only a lower bound until the cell
+// is rescanned, which is put off until a query could actually be answered differently by it.
+class HiZBuffer
+{
+public:
+	static const int CellSize = 8;
+
+	// cells of the InWidth x InHeight pixel region of InZBuffer, pixel (X, Y) of the region at InZBuffer[InStride*Y + X].
+	void Build(const float* InZBuffer, int InStride, int InWidth, int InHeight)
+	{
+		Width = InWidth;
+		Height = InHeight;
+		NumCellsX = (InWidth + CellSize - 1) / CellSize;
+		NumCellsY = (InHeight + CellSize - 1) / CellSize;
+		Cells.resize(NumCellsX*NumCellsY);
+		for (int CellY = 0; CellY < NumCellsY; CellY++)
+		{
+			for (int CellX = 0; CellX < NumCellsX; CellX++)
+			{
+				Rescan(CellX, CellY, InZBuffer, InStride);
+			}
+		}
+	}
+
+	int CellsX() const { return NumCellsX; }
+	int CellsY() const { return NumCellsY; }
+	float MinZ(int InCellX, int InCellY) const { return Cells[InCellY*NumCellsX + InCellX].MinZ; }
+	float MaxZ(int InCellX, int InCellY) const { return Cells[InCellY*NumCellsX + InCellX].MaxZ; }
+
+	// InNearestZ is the largest depth a triangle can have over the cell, InTolerance covers rounding of the
+	// rasterizer's depth stepping. true when none of the triangle's pixels can pass the depth test.
+	// InZBuffer/InStride are the buffer given to Build, read when the cell has to be rescanned.
+	bool IsOccluded(int InCellX, int InCellY, float InNearestZ, float InTolerance, const float* InZBuffer, int InStride)
+	{
+		Cell& Target = Cells[InCellY*NumCellsX + InCellX];
+		const float NearestZ = InNearestZ + InTolerance;
+		if (NearestZ < Target.MinZ)
+		{
+			return true;
+		}
+		// a triangle in front of the cell's nearest pixel is visible whatever MinZ is.
+		if (!Target.bDirty || NearestZ >= Target.MaxZ)
+		{
+			return false;
+		}
+		Rescan(InCellX, InCellY, InZBuffer, InStride);
+		return NearestZ < Target.MinZ;
+	}
+
+	// a triangle wrote pixels of the cell: InNearestWritten is the largest z written, bInFarthestOverwritten
+	// tells that one of the overwritten pixels held the cell's MinZ.
+	void OnWrite(int InCellX, int InCellY, float InNearestWritten, bool bInFarthestOverwritten)
+	{
+		Cell& Target = Cells[InCellY*NumCellsX + InCellX];
+		Target.MaxZ = std::max(Target.MaxZ, InNearestWritten);
+		Target.bDirty |= bInFarthestOverwritten;
+	}
+
+private:
+	struct Cell
+	{
+		float MinZ;
+		float MaxZ;
+		bool bDirty; // MinZ may be lower than the cell's farthest pixel
+	};
+
+	void Rescan(int InCellX, int InCellY, const float* InZBuffer, int InStride)
+	{
+		const int XBegin = InCellX*CellSize, XEnd = std::min(XBegin + CellSize, Width);
+		const int YBegin = InCellY*CellSize, YEnd = std::min(YBegin + CellSize, Height);
+		float CellMin = InZBuffer[InStride*YBegin + XBegin];
+		float CellMax = CellMin;
+		for (int Y = YBegin; Y < YEnd; Y++)
+		{
+			const float* Row = InZBuffer + InStride*Y;
+			for (int X = XBegin; X < XEnd; X++)
+			{
+				CellMin = std::min(CellMin, Row[X]);
+				CellMax = std::max(CellMax, Row[X]);
+			}
+		}
+		Cell& Target = Cells[InCellY*NumCellsX + InCellX];
+		Target.MinZ = CellMin;
+		Target.MaxZ = CellMax;
+		Target.bDirty = false;
+	}
+
+	std::vector<Cell> Cells;
+	int NumCellsX = 0, NumCellsY = 0;
+	int Width = 0, Height = 0;
+};
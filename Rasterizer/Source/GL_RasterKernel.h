@@ -0,0 +1,655 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+#include "../Utils/geometry.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define GL_RASTER_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#else
+#define GL_RASTER_X86 0
+#endif
+
+// msvc compiles any intrinsic without extra flags, gcc/clang need the instruction set enabled per function.
+#if GL_RASTER_X86 && (defined(__GNUC__) || defined(__clang__))
+#define GL_TARGET_SSE2 __attribute__((target("sse2")))
+#define GL_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define GL_TARGET_SSE2
+#define GL_TARGET_AVX2
+#endif
+
+// float math whose bits must not depend on the instruction set: a*b + c is never fused into an fma.
+// gcc fuses across statements (-ffp-contract=fast, its default outside strict iso mode) and clang within an expression
+// (-ffp-contract=on) as soon as fma is enabled, e.g. by -mfma or -march=native. GL_NO_FP_CONTRACT goes on the function,
+// GL_FP_CONTRACT_OFF first in its body. msvc (v142) never emits fma without /arch:AVX2, which this project doesn't set.
+#if defined(__clang__)
+#define GL_NO_FP_CONTRACT
+#define GL_FP_CONTRACT_OFF _Pragma("clang fp contract(off)")
+#elif defined(__GNUC__)
+#define GL_NO_FP_CONTRACT __attribute__((optimize("fp-contract=off")))
+#define GL_FP_CONTRACT_OFF
+#else
+#define GL_NO_FP_CONTRACT
+#define GL_FP_CONTRACT_OFF
+#endif
+
+// which triangles are thrown away at setup by their winding on screen.
+// front faces are counter-clockwise on screen (y axis up), the winding meshes are modelled with.
+enum class ECullMode { None, Back, Front };
+
+// per-triangle constants of the rasterizer, computed once before walking the pixels.
+// vertices are snapped to 24.8 fixed point (1/256 pixel) and pixels are sampled at integer coordinates.
+// edge function of edge i (the edge opposite to vertex i) is, in 64 bit integers,
+// E_i(X, Y) = StepX[i]*X + StepY[i]*Y + C[i], i.e. twice the signed area (in 1/65536 pixel^2) of the triangle made
+// of the edge and point (X, Y). it is exact, so an edge shared by two triangles gives the same value with opposite
+// sign to both, and with the top-left rule every sample on it belongs to exactly one of them: no cracks, no double hits.
+// signs are flipped for clockwise triangles so E_i > 0 always means "inside of edge i".
+// barycentric coordinate of vertex i is E_i / (E_0 + E_1 + E_2) = E_i * InvArea, computed in float from the exact E_i.
+// depth and 1/w are linear over the screen as well, so they step with their float gradients.
+struct TriangleSetup
+{
+	static const int SubPixelBits = 8;
+	static const int SubPixelScale = 1 << SubPixelBits;
+	// vertices further out than this many pixels are rejected (clipping keeps them in the guard band anyway),
+	// which keeps edge functions in 46 bits and 7 pixel steps in 32 bits.
+	// with the clipper's default 1024 pixel guard band an 800x800 frame has vertices within -1024..1824, so 24.8
+	// differences reach 2^20 and their products 2^40: edge functions need 64 bit lanes, 32 bits would need the
+	// whole triangle within about 180 pixels.
+	static const int MaxCoordinate = 8192;
+
+	// integer edge functions, see above. StepX/StepY are the increments of one pixel right/up.
+	long long StepX[3], StepY[3], C[3];
+	// top-left fill rule: sample exactly on an edge belongs to the triangle only when the edge is a top or left edge,
+	// so a sample on an edge shared by two triangles is drawn once. Bias[i] is 0 for those and -1 else,
+	// sample is inside when E_i + Bias[i] >= 0 for all edges.
+	int Bias[3];
+	// StepX*Lane + Bias for lanes 0..7 of a pixel block.
+	long long LaneOffset[3][8];
+
+	// float copies of StepX/StepY to step barycentric, depth and 1/w.
+	float A[3], B[3];
+	float InvArea;
+
+	// sample positions covered by the bounding box of the snapped triangle, inclusive.
+	int MinX, MinY, MaxX, MaxY;
+
+	// depth(X, Y) = Z0 + DZDX*(X - X0) + DZDY*(Y - Y0), with (X0, Y0) being snapped vertex 0.
+	float X0, Y0;
+	float Z0, DZDX, DZDY;
+
+	// 1/w of the vertices to do perspective correct barycentric, all 1 means screen space (affine) barycentric.
+	// 1/w is linear on screen, so it is set up and stepped like depth, per pixel only its reciprocal is taken.
+	bool bPerspective;
+	float InvW[3];
+	float InvW0, DInvWDX, DInvWDY;
+	// InvW[i]*InvArea: perspective correct barycentric of vertex i is E_i*BaryScale[i] / (1/w of pixel).
+	float BaryScale[3];
+
+	// returns false for degenerated (zero area) triangle, which has nothing to draw, or one out of MaxCoordinate.
+	GL_NO_FP_CONTRACT bool Init(const Vec3f* InScreenVert, const float* InInvW = nullptr)
+	{
+		GL_FP_CONTRACT_OFF
+		int FixedX[3], FixedY[3];
+		if (!Snap(InScreenVert, FixedX, FixedY))
+		{
+			return false;
+		}
+
+		long long Area = FixedArea(FixedX, FixedY);
+		if (Area == 0)
+		{
+			return false;
+		}
+		const long long Sign = Area < 0 ? -1 : 1;
+		Area *= Sign;
+		InvArea = 1.f / (float)Area;
+
+		for (int i = 0; i < 3; i++)
+		{
+			const int From = (i + 1) % 3;
+			const int To = (i + 2) % 3;
+			// E_i = (From.y - To.y)*(256X - From.x) + (To.x - From.x)*(256Y - From.y), in fixed point.
+			const long long EdgeA = Sign*(FixedY[From] - FixedY[To]);
+			const long long EdgeB = Sign*(FixedX[To] - FixedX[From]);
+			StepX[i] = EdgeA*SubPixelScale;
+			StepY[i] = EdgeB*SubPixelScale;
+			C[i] = -EdgeA*FixedX[From] - EdgeB*FixedY[From];
+			// left edge: inside is to its right. top edge: horizontal and inside is below it (y axis is up).
+			Bias[i] = (EdgeA > 0 || (EdgeA == 0 && EdgeB < 0)) ? 0 : -1;
+			for (int Lane = 0; Lane < 8; Lane++)
+			{
+				LaneOffset[i][Lane] = StepX[i] * Lane + Bias[i];
+			}
+			A[i] = (float)StepX[i];
+			B[i] = (float)StepY[i];
+		}
+
+		MinX = CeilPixel(std::min(FixedX[0], std::min(FixedX[1], FixedX[2])));
+		MinY = CeilPixel(std::min(FixedY[0], std::min(FixedY[1], FixedY[2])));
+		MaxX = FloorPixel(std::max(FixedX[0], std::max(FixedX[1], FixedX[2])));
+		MaxY = FloorPixel(std::max(FixedY[0], std::max(FixedY[1], FixedY[2])));
+
+		X0 = (float)FixedX[0] / SubPixelScale;
+		Y0 = (float)FixedY[0] / SubPixelScale;
+		Z0 = InScreenVert[0].z;
+		DZDX = (InScreenVert[0].z*A[0] + InScreenVert[1].z*A[1] + InScreenVert[2].z*A[2])*InvArea;
+		DZDY = (InScreenVert[0].z*B[0] + InScreenVert[1].z*B[1] + InScreenVert[2].z*B[2])*InvArea;
+
+		bPerspective = InInvW != nullptr;
+		for (int i = 0; i < 3; i++)
+		{
+			InvW[i] = bPerspective ? InInvW[i] : 1.f;
+		}
+		InvW0 = InvW[0];
+		DInvWDX = (InvW[0] * A[0] + InvW[1] * A[1] + InvW[2] * A[2])*InvArea;
+		DInvWDY = (InvW[0] * B[0] + InvW[1] * B[1] + InvW[2] * B[2])*InvArea;
+		for (int i = 0; i < 3; i++)
+		{
+			BaryScale[i] = InvW[i] * InvArea;
+		}
+		return true;
+	}
+
+	// vertex position in 24.8 fixed point, rounded to nearest. false when out of MaxCoordinate.
+	static inline bool Snap(const Vec3f* InScreenVert, int* OutX, int* OutY)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			// also false for nan.
+			if (!(std::abs(InScreenVert[i].x) <= MaxCoordinate && std::abs(InScreenVert[i].y) <= MaxCoordinate))
+			{
+				return false;
+			}
+			OutX[i] = (int)std::floor(InScreenVert[i].x * SubPixelScale + 0.5f);
+			OutY[i] = (int)std::floor(InScreenVert[i].y * SubPixelScale + 0.5f);
+		}
+		return true;
+	}
+
+	// first/last integer pixel coordinate at or after/before a fixed point one.
+	static inline int CeilPixel(int InFixed) { return (InFixed + SubPixelScale - 1) >> SubPixelBits; }
+	static inline int FloorPixel(int InFixed) { return InFixed >> SubPixelBits; }
+
+	// twice the signed area of the snapped triangle in 1/65536 pixel^2, positive for counter-clockwise. this is E_0 at vertex 0.
+	static inline long long FixedArea(const int* InX, const int* InY)
+	{
+		return (long long)(InY[1] - InY[2]) * (InX[0] - InX[1]) + (long long)(InX[2] - InX[1]) * (InY[0] - InY[1]);
+	}
+
+	// signed area Init sees for the triangle, 0 when it draws nothing (degenerated or out of MaxCoordinate).
+	static inline long long SignedArea(const Vec3f* InScreenVert)
+	{
+		int FixedX[3], FixedY[3];
+		return Snap(InScreenVert, FixedX, FixedY) ? FixedArea(FixedX, FixedY) : 0;
+	}
+
+	// snapped to zero area, no sample can be inside.
+	static inline bool IsDegenerate(long long InSignedArea)
+	{
+		return InSignedArea == 0;
+	}
+
+	static inline bool IsCulled(long long InSignedArea, ECullMode InCullMode)
+	{
+		return (InCullMode == ECullMode::Back && InSignedArea < 0) || (InCullMode == ECullMode::Front && InSignedArea > 0);
+	}
+
+	// pixels whose sample can be inside the triangle, clamped to [0, InWidth) x [0, InHeight).
+	// false when there is none. same range Init computes and the rasterizer walks.
+	static inline bool PixelBounds(const Vec3f* InScreenVert, int InWidth, int InHeight, int& OutMinX, int& OutMinY, int& OutMaxX, int& OutMaxY)
+	{
+		int FixedX[3], FixedY[3];
+		if (!Snap(InScreenVert, FixedX, FixedY))
+		{
+			return false;
+		}
+		OutMinX = std::max(0, CeilPixel(std::min(FixedX[0], std::min(FixedX[1], FixedX[2]))));
+		OutMinY = std::max(0, CeilPixel(std::min(FixedY[0], std::min(FixedY[1], FixedY[2]))));
+		OutMaxX = std::min(InWidth - 1, FloorPixel(std::max(FixedX[0], std::max(FixedX[1], FixedX[2]))));
+		OutMaxY = std::min(InHeight - 1, FloorPixel(std::max(FixedY[0], std::max(FixedY[1], FixedY[2]))));
+		return OutMinX <= OutMaxX && OutMinY <= OutMaxY;
+	}
+
+	// evaluate edge functions exactly, depth and 1/w directly at pixel (X, Y).
+	inline void EvaluateAt(int X, int Y, long long* OutE, float& OutZ, float& OutInvW) const
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			OutE[i] = StepX[i] * X + StepY[i] * Y + C[i];
+		}
+		OutZ = Z0 + DZDX*(X - X0) + DZDY*(Y - Y0);
+		OutInvW = InvW0 + DInvWDX*(X - X0) + DInvWDY*(Y - Y0);
+	}
+
+	inline bool IsInside(const long long* InE) const
+	{
+		return InE[0] + Bias[0] >= 0 && InE[1] + Bias[1] >= 0 && InE[2] + Bias[2] >= 0;
+	}
+
+	// barycentric coordinates passed to fragment shader.
+	inline Vec3f Barycentric(const long long* InE, float InPixelInvW) const
+	{
+		const float E[3] = { (float)InE[0], (float)InE[1], (float)InE[2] };
+		if (bPerspective)
+		{
+			// attributes are linear in camera space, not in screen space: weight with 1/w and renormalize.
+			float InvPixelInvW = 1.f / InPixelInvW;
+			return Vec3f(E[0] * BaryScale[0] * InvPixelInvW, E[1] * BaryScale[1] * InvPixelInvW, E[2] * BaryScale[2] * InvPixelInvW);
+		}
+		return Vec3f(E[0] * InvArea, E[1] * InvArea, E[2] * InvArea);
+	}
+};
+
+// 8 horizontally adjacent pixels of a row as computed by RasterKernel::TestBlock, in SoA layout.
+struct PixelBlock
+{
+	static const int Size = 8;
+
+	float E[3][Size];
+	float Z[Size];
+	float InvW[Size];
+};
+
+// barycentric coordinates of the pixels of a PixelBlock handed to the batched fragment shader, in SoA layout.
+// only lanes in LiveMask are to be shaded, the others hold valid numbers but are outside of triangle or occluded.
+struct BarycentricBlock
+{
+	static const int Size = PixelBlock::Size;
+
+	float B[3][Size];
+	// barycentric coordinates of the pixel one row up of every even lane, for the screen space derivatives of QuadDerivatives.
+	float Up[3][Size / 2];
+	unsigned LiveMask;
+
+	inline Vec3f Lane(int InLane) const { return Vec3f(B[0][InLane], B[1][InLane], B[2][InLane]); }
+
+	// interpolate a per-vertex value for all lanes, same operation order as the per pixel fragment shaders use.
+	inline void Interpolate(float InV0, float InV1, float InV2, float* OutValues) const
+	{
+		for (int Lane = 0; Lane < Size; Lane++)
+		{
+			OutValues[Lane] = InV0 * B[0][Lane] + InV1 * B[1][Lane] + InV2 * B[2][Lane];
+		}
+	}
+
+	// derivatives of a per-vertex value along screen x and y, given InValues from Interpolate.
+	// a block is a single row, so derivatives come from 2x2 quads of lanes 2k and 2k+1 and the two pixels above them,
+	// of which only the one above lane 2k is needed: dx = V(2k+1) - V(2k), dy = Up(k) - V(2k). both lanes of a quad share them.
+	inline void QuadDerivatives(float InV0, float InV1, float InV2, const float* InValues, float* OutDX, float* OutDY) const
+	{
+		for (int Quad = 0; Quad < Size / 2; Quad++)
+		{
+			const int Lane = 2 * Quad;
+			const float Above = InV0 * Up[0][Quad] + InV1 * Up[1][Quad] + InV2 * Up[2][Quad];
+			OutDX[Lane] = OutDX[Lane + 1] = InValues[Lane + 1] - InValues[Lane];
+			OutDY[Lane] = OutDY[Lane + 1] = Above - InValues[Lane];
+		}
+	}
+};
+
+// coverage and depth test of 8 pixels at once.
+// coverage is exact: 64 bit integer edge functions of the 8 lanes, whose sign bits give the mask.
+// for barycentric, depth and 1/w, lane k of a span gets E_i = SpanE_i + A_i*k in float: one multiply and one add
+// from the exactly evaluated span start, done in that order by every instruction set, so AVX2, SSE2 and scalar
+// give identical bits. TriangleSetup::Init and the TestBlock paths are compiled without fma contraction
+// (GL_NO_FP_CONTRACT), so the bits are also the same whether or not the build enables fma.
+// instruction set is detected once at runtime and can be lowered with SetLevel, e.g. to compare paths.
+class RasterKernel
+{
+public:
+	enum class ELevel { Scalar, SSE2, AVX2 };
+
+	static ELevel GetLevel() { return ActiveLevel(); }
+
+	// never goes above what cpu supports.
+	static void SetLevel(ELevel InLevel) { ActiveLevel() = std::min(InLevel, DetectLevel()); }
+
+	static const char* GetLevelName(ELevel InLevel)
+	{
+		return InLevel == ELevel::AVX2 ? "AVX2" : (InLevel == ELevel::SSE2 ? "SSE2" : "Scalar");
+	}
+
+	// test InCount (<= 8) pixels, lane 0 being pixel InK of the span whose start values are InSpanE/InSpanZ/InSpanInvW.
+	// InZRow is z buffer at lane 0. returns bit mask of lanes covered by triangle and passing depth test,
+	// OutBlock gets edge functions/depth/1/w of all lanes, unless no lane is covered at all.
+	static inline unsigned TestBlock(const TriangleSetup& InSetup, const long long* InSpanE, float InSpanZ, float InSpanInvW,
+		int InK, int InCount, const float* InZRow, PixelBlock& OutBlock)
+	{
+		long long BlockE[3];
+		for (int i = 0; i < 3; i++)
+		{
+			BlockE[i] = InSpanE[i] + InSetup.StepX[i] * InK;
+		}
+
+		unsigned Covered;
+		switch (ActiveLevel())
+		{
+#if GL_RASTER_X86
+		case ELevel::AVX2:
+			Covered = CoverageAVX2(InSetup, BlockE);
+			break;
+		case ELevel::SSE2:
+			Covered = CoverageSSE2(InSetup, BlockE);
+			break;
+#endif
+		default:
+			Covered = CoverageScalar(InSetup, BlockE);
+			break;
+		}
+		Covered &= (1u << InCount) - 1;
+		if (!Covered)
+		{
+			return 0;
+		}
+
+		const float SpanE[3] = { (float)InSpanE[0], (float)InSpanE[1], (float)InSpanE[2] };
+		// don't read past the end of the row for a partial block.
+		float PaddedZ[PixelBlock::Size];
+		if (InCount < PixelBlock::Size)
+		{
+			memset(PaddedZ, 0, sizeof(PaddedZ));
+			memcpy(PaddedZ, InZRow, InCount * sizeof(float));
+			InZRow = PaddedZ;
+		}
+
+		unsigned Mask;
+		switch (ActiveLevel())
+		{
+#if GL_RASTER_X86
+		case ELevel::AVX2:
+			Mask = TestBlockAVX2(InSetup, SpanE, InSpanZ, InSpanInvW, InK, InZRow, OutBlock);
+			break;
+		case ELevel::SSE2:
+			Mask = TestBlockSSE2(InSetup, SpanE, InSpanZ, InSpanInvW, InK, InZRow, OutBlock);
+			break;
+#endif
+		default:
+			Mask = TestBlockScalar(InSetup, SpanE, InSpanZ, InSpanInvW, InK, InZRow, OutBlock);
+			break;
+		}
+		return Mask & Covered;
+	}
+
+	// barycentric coordinates of all lanes of a tested block, same arithmetic as TriangleSetup::Barycentric.
+	static inline void ComputeBarycentric(const TriangleSetup& InSetup, const PixelBlock& InBlock, unsigned InLiveMask, BarycentricBlock& OutBlock)
+	{
+		OutBlock.LiveMask = InLiveMask;
+		if (InSetup.bPerspective)
+		{
+			// the one division per pixel of perspective correction.
+			for (int Lane = 0; Lane < PixelBlock::Size; Lane++)
+			{
+				const float InvPixelInvW = 1.f / InBlock.InvW[Lane];
+				for (int i = 0; i < 3; i++)
+				{
+					OutBlock.B[i][Lane] = InBlock.E[i][Lane] * InSetup.BaryScale[i] * InvPixelInvW;
+				}
+			}
+			for (int Quad = 0; Quad < PixelBlock::Size / 2; Quad++)
+			{
+				const float InvUpInvW = 1.f / (InBlock.InvW[2 * Quad] + InSetup.DInvWDY);
+				for (int i = 0; i < 3; i++)
+				{
+					OutBlock.Up[i][Quad] = (InBlock.E[i][2 * Quad] + InSetup.B[i]) * InSetup.BaryScale[i] * InvUpInvW;
+				}
+			}
+			return;
+		}
+
+		for (int Lane = 0; Lane < PixelBlock::Size; Lane++)
+		{
+			for (int i = 0; i < 3; i++)
+			{
+				OutBlock.B[i][Lane] = InBlock.E[i][Lane] * InSetup.InvArea;
+			}
+		}
+		for (int Quad = 0; Quad < PixelBlock::Size / 2; Quad++)
+		{
+			for (int i = 0; i < 3; i++)
+			{
+				OutBlock.Up[i][Quad] = (InBlock.E[i][2 * Quad] + InSetup.B[i]) * InSetup.InvArea;
+			}
+		}
+	}
+
+	// barycentric coordinates of a piece of a clipped triangle to those of the whole triangle.
+	// corner i of the piece has barycentric coordinates InCornerWeights[i] in the whole triangle.
+	static inline void RemapBarycentric(const Vec3f* InCornerWeights, BarycentricBlock& InOutBlock)
+	{
+		for (int Lane = 0; Lane < PixelBlock::Size; Lane++)
+		{
+			const float B0 = InOutBlock.B[0][Lane];
+			const float B1 = InOutBlock.B[1][Lane];
+			const float B2 = InOutBlock.B[2][Lane];
+			for (int i = 0; i < 3; i++)
+			{
+				InOutBlock.B[i][Lane] = InCornerWeights[0].raw[i] * B0 + InCornerWeights[1].raw[i] * B1 + InCornerWeights[2].raw[i] * B2;
+			}
+		}
+		for (int Quad = 0; Quad < PixelBlock::Size / 2; Quad++)
+		{
+			const float B0 = InOutBlock.Up[0][Quad];
+			const float B1 = InOutBlock.Up[1][Quad];
+			const float B2 = InOutBlock.Up[2][Quad];
+			for (int i = 0; i < 3; i++)
+			{
+				InOutBlock.Up[i][Quad] = InCornerWeights[0].raw[i] * B0 + InCornerWeights[1].raw[i] * B1 + InCornerWeights[2].raw[i] * B2;
+			}
+		}
+	}
+
+	// write depth of the lanes in InMask to z buffer row, other lanes are left untouched.
+	static inline void StoreDepth(unsigned InMask, const float* InZ, float* OutZRow)
+	{
+#if GL_RASTER_X86
+		if (ActiveLevel() == ELevel::AVX2)
+		{
+			StoreDepthAVX2(InMask, InZ, OutZRow);
+			return;
+		}
+#endif
+		for (int Lane = 0; Lane < PixelBlock::Size; Lane++)
+		{
+			if (InMask & (1u << Lane))
+			{
+				OutZRow[Lane] = InZ[Lane];
+			}
+		}
+	}
+
+	// number of lanes set in InMask.
+	static inline int CountLanes(unsigned InMask)
+	{
+		int Count = 0;
+		for (; InMask; InMask &= InMask - 1)
+		{
+			Count++;
+		}
+		return Count;
+	}
+
+	// index of lowest set bit, InMask must not be 0.
+	static inline int LowestLane(unsigned InMask)
+	{
+#if defined(_MSC_VER)
+		unsigned long Index;
+		_BitScanForward(&Index, InMask);
+		return (int)Index;
+#elif defined(__GNUC__) || defined(__clang__)
+		return __builtin_ctz(InMask);
+#else
+		int Index = 0;
+		while (!(InMask & (1u << Index))) Index++;
+		return Index;
+#endif
+	}
+
+	static ELevel DetectLevel()
+	{
+#if GL_RASTER_X86
+#if defined(_MSC_VER)
+		int Info[4];
+		__cpuid(Info, 0);
+		int MaxLeaf = Info[0];
+		__cpuid(Info, 1);
+		bool bSSE2 = (Info[3] & (1 << 26)) != 0;
+		bool bAVX = (Info[2] & (1 << 28)) != 0;
+		// os must save ymm registers on context switch.
+		bool bOSXSave = (Info[2] & (1 << 27)) != 0;
+		bool bAVX2 = false;
+		if (MaxLeaf >= 7 && bAVX && bOSXSave && (_xgetbv(0) & 6) == 6)
+		{
+			__cpuidex(Info, 7, 0);
+			bAVX2 = (Info[1] & (1 << 5)) != 0;
+		}
+#else
+		__builtin_cpu_init();
+		bool bSSE2 = __builtin_cpu_supports("sse2") != 0;
+		bool bAVX2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+		if (bAVX2)
+		{
+			return ELevel::AVX2;
+		}
+		if (bSSE2)
+		{
+			return ELevel::SSE2;
+		}
+#endif
+		return ELevel::Scalar;
+	}
+
+private:
+	static ELevel& ActiveLevel()
+	{
+		static ELevel Level = DetectLevel();
+		return Level;
+	}
+
+	GL_NO_FP_CONTRACT static unsigned TestBlockScalar(const TriangleSetup& InSetup, const float* InSpanE, float InSpanZ, float InSpanInvW,
+		int InK, const float* InZRow, PixelBlock& OutBlock)
+	{
+		GL_FP_CONTRACT_OFF
+		unsigned Mask = 0;
+		for (int Lane = 0; Lane < PixelBlock::Size; Lane++)
+		{
+			float K = (float)(InK + Lane);
+			for (int i = 0; i < 3; i++)
+			{
+				OutBlock.E[i][Lane] = InSpanE[i] + InSetup.A[i] * K;
+			}
+			OutBlock.Z[Lane] = InSpanZ + InSetup.DZDX * K;
+			OutBlock.InvW[Lane] = InSpanInvW + InSetup.DInvWDX * K;
+
+			if (InZRow[Lane] <= OutBlock.Z[Lane])
+			{
+				Mask |= 1u << Lane;
+			}
+		}
+		return Mask;
+	}
+
+	// lanes whose sample is inside all 3 edges, InBlockE being the edge functions at lane 0.
+	static unsigned CoverageScalar(const TriangleSetup& InSetup, const long long* InBlockE)
+	{
+		unsigned Mask = 0;
+		for (int Lane = 0; Lane < PixelBlock::Size; Lane++)
+		{
+			const long long LaneE[3] = { InBlockE[0] + InSetup.StepX[0] * Lane, InBlockE[1] + InSetup.StepX[1] * Lane, InBlockE[2] + InSetup.StepX[2] * Lane };
+			if (InSetup.IsInside(LaneE))
+			{
+				Mask |= 1u << Lane;
+			}
+		}
+		return Mask;
+	}
+
+#if GL_RASTER_X86
+	GL_TARGET_SSE2 GL_NO_FP_CONTRACT static unsigned TestBlockSSE2(const TriangleSetup& InSetup, const float* InSpanE, float InSpanZ, float InSpanInvW,
+		int InK, const float* InZRow, PixelBlock& OutBlock)
+	{
+		GL_FP_CONTRACT_OFF
+		unsigned Mask = 0;
+		// two halves of 4 lanes.
+		for (int Half = 0; Half < 2; Half++)
+		{
+			const int First = Half * 4;
+			const __m128 K = _mm_add_ps(_mm_set1_ps((float)(InK + First)), _mm_setr_ps(0.f, 1.f, 2.f, 3.f));
+
+			for (int i = 0; i < 3; i++)
+			{
+				_mm_storeu_ps(OutBlock.E[i] + First, _mm_add_ps(_mm_set1_ps(InSpanE[i]), _mm_mul_ps(_mm_set1_ps(InSetup.A[i]), K)));
+			}
+
+			__m128 Z = _mm_add_ps(_mm_set1_ps(InSpanZ), _mm_mul_ps(_mm_set1_ps(InSetup.DZDX), K));
+			_mm_storeu_ps(OutBlock.Z + First, Z);
+			_mm_storeu_ps(OutBlock.InvW + First, _mm_add_ps(_mm_set1_ps(InSpanInvW), _mm_mul_ps(_mm_set1_ps(InSetup.DInvWDX), K)));
+
+			Mask |= (unsigned)_mm_movemask_ps(_mm_cmple_ps(_mm_loadu_ps(InZRow + First), Z)) << First;
+		}
+		return Mask;
+	}
+
+	// 2 lanes of 64 bit per register, E + Bias >= 0 is a clear sign bit, which movemask_pd picks up.
+	GL_TARGET_SSE2 static unsigned CoverageSSE2(const TriangleSetup& InSetup, const long long* InBlockE)
+	{
+		unsigned Outside = 0;
+		for (int i = 0; i < 3; i++)
+		{
+			const __m128i E = _mm_set1_epi64x(InBlockE[i]);
+			for (int Pair = 0; Pair < 4; Pair++)
+			{
+				const __m128i LaneE = _mm_add_epi64(E, _mm_loadu_si128((const __m128i*)(InSetup.LaneOffset[i] + Pair * 2)));
+				Outside |= (unsigned)_mm_movemask_pd(_mm_castsi128_pd(LaneE)) << (Pair * 2);
+			}
+		}
+		return ~Outside & 0xff;
+	}
+
+	GL_TARGET_AVX2 GL_NO_FP_CONTRACT static unsigned TestBlockAVX2(const TriangleSetup& InSetup, const float* InSpanE, float InSpanZ, float InSpanInvW,
+		int InK, const float* InZRow, PixelBlock& OutBlock)
+	{
+		GL_FP_CONTRACT_OFF
+		const __m256 K = _mm256_add_ps(_mm256_set1_ps((float)InK), _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f));
+
+		for (int i = 0; i < 3; i++)
+		{
+			_mm256_storeu_ps(OutBlock.E[i], _mm256_add_ps(_mm256_set1_ps(InSpanE[i]), _mm256_mul_ps(_mm256_set1_ps(InSetup.A[i]), K)));
+		}
+
+		__m256 Z = _mm256_add_ps(_mm256_set1_ps(InSpanZ), _mm256_mul_ps(_mm256_set1_ps(InSetup.DZDX), K));
+		_mm256_storeu_ps(OutBlock.Z, Z);
+		_mm256_storeu_ps(OutBlock.InvW, _mm256_add_ps(_mm256_set1_ps(InSpanInvW), _mm256_mul_ps(_mm256_set1_ps(InSetup.DInvWDX), K)));
+
+		return (unsigned)_mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(InZRow), Z, _CMP_LE_OQ));
+	}
+
+	// same as CoverageSSE2 with 4 lanes of 64 bit per register.
+	GL_TARGET_AVX2 static unsigned CoverageAVX2(const TriangleSetup& InSetup, const long long* InBlockE)
+	{
+		unsigned Outside = 0;
+		for (int i = 0; i < 3; i++)
+		{
+			const __m256i E = _mm256_set1_epi64x(InBlockE[i]);
+			const __m256i Low = _mm256_add_epi64(E, _mm256_loadu_si256((const __m256i*)InSetup.LaneOffset[i]));
+			const __m256i High = _mm256_add_epi64(E, _mm256_loadu_si256((const __m256i*)(InSetup.LaneOffset[i] + 4)));
+			Outside |= (unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(Low)) | ((unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(High)) << 4);
+		}
+		return ~Outside & 0xff;
+	}
+
+	GL_TARGET_AVX2 static void StoreDepthAVX2(unsigned InMask, const float* InZ, float* OutZRow)
+	{
+		// spread mask bits to lanes: lane k is all ones when bit k is set.
+		const __m256i Bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+		__m256i LaneMask = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32((int)InMask), Bits), Bits);
+		_mm256_maskstore_ps(OutZRow, LaneMask, _mm256_loadu_ps(InZ));
+	}
+#endif
+};
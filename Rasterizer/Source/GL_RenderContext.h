@@ -0,0 +1,36 @@
+#pragma once
+#include "..\Utils\model.h"
+#include "..\Utils\geometry.h"
+#include "GL_Transform.h"
+
+// Everything one render reads: model, camera, viewport, light and the uniforms derived from them.
+// shaders keep a pointer to the context they are created with instead of reading globals,
+// so independent renders (each with its own context) can run at the same time in one process.
+// the context must outlive the shaders using it and must not change while a draw is running.
+struct RenderContext
+{
+	Model* ModelData = nullptr;
+
+	// camera
+	Vec3f Eye;
+	Vec3f Center;
+
+	// viewport, size of the frame and shadow buffers.
+	int Width = 0;
+	int Height = 0;
+
+	Vec3f LightDir;
+
+	Mat4 VPMatrix;
+	Mat4 Projection;
+	Mat4 ModelView;
+	Mat4 Uniform_M; //Projection*ModelView
+	Mat4 Uniform_MIT; // inverse transposed Uniform_M
+
+	// recompute Uniform_M/Uniform_MIT after Projection or ModelView changed.
+	void UpdateUniforms()
+	{
+		Uniform_M = Projection*ModelView;
+		Uniform_MIT = Uniform_M.Transpose().Inverse();
+	}
+};
@@ -1,65 +1,126 @@
 #pragma once
 #include "..\Utils\geometry.h"
 #include "..\Utils\tgaimage.h"
-#include "GL_Global.h"
+#include "GL_RenderContext.h"
 #include <algorithm>
 #include "GL_Transform.h"
+#include "GL_RasterKernel.h"
 
 // Shader interface
 class IShader
 {
 public:
+	// shader reads model, transforms and light from InContext, which must outlive the shader.
+	IShader(const RenderContext& InContext) : Context(&InContext) {};
 	virtual ~IShader() {};
 	// Vertex shader is to transform the coordinates of the vertices and prepare data for the fragment shader.
 	// So Vertex shader is manipulate vertex of triangle.
-	virtual Vec3f Vertex(int InFaceIndex, int InVertexIndex) = 0;
+	// returns homogeneous screen position (viewport*projection*modelview*vertex) without dividing by w,
+	// the rasterizer clips the triangle (see Clipper) before dividing.
+	virtual Mat41 Vertex(int InFaceIndex, int InVertexIndex) = 0;
+	// Triangle setup is called once per triangle after Vertex ran for its 3 vertices and before any of its fragments.
+	// it is the place to compute what only depends on the triangle (face normal, tangent basis...), instead of per pixel.
+	virtual void SetupTriangle() {};
 	// Fragment shader is to determine the color of the current pixel and discard current pixel by returning true.
 	// Fragment shader is manipulate pixel's color.
 	virtual bool Fragment(Vec3f InBarycentric, TGAColor& OutColor) = 0;
+
+	// Batched fragment shader for the live lanes of a block of pixels, returns bit mask of discarded lanes.
+	// this one goes through virtual Fragment per pixel, it is only used when the rasterizer is given a plain IShader.
+	unsigned FragmentBlock(const BarycentricBlock& InBlock, TGAColor* OutColors)
+	{
+		unsigned Discarded = 0;
+		for (unsigned Live = InBlock.LiveMask; Live; Live &= Live - 1)
+		{
+			int Lane = RasterKernel::LowestLane(Live);
+			if (Fragment(InBlock.Lane(Lane), OutColors[Lane]))
+			{
+				Discarded |= 1u << Lane;
+			}
+		}
+		return Discarded;
+	}
+
+protected:
+	const RenderContext* Context;
+};
+
+// Base of the concrete shaders. IShader keeps them usable through the virtual interface,
+// while the rasterizer templated on the concrete (final) shader type calls Derived::Fragment directly, so it can be inlined.
+// a shader can hide FragmentBlock with its own version which interpolates its varyings for all lanes at once (SoA).
+template <class Derived>
+class ShaderBase :public IShader
+{
+public:
+	ShaderBase(const RenderContext& InContext) : IShader(InContext) {};
+
+	unsigned FragmentBlock(const BarycentricBlock& InBlock, TGAColor* OutColors)
+	{
+		Derived& Shader = static_cast<Derived&>(*this);
+		unsigned Discarded = 0;
+		for (unsigned Live = InBlock.LiveMask; Live; Live &= Live - 1)
+		{
+			int Lane = RasterKernel::LowestLane(Live);
+			if (Shader.Derived::Fragment(InBlock.Lane(Lane), OutColors[Lane]))
+			{
+				Discarded |= 1u << Lane;
+			}
+		}
+		return Discarded;
+	}
 };
 
 // Flat Shader
-class FlatShader :public IShader
+class FlatShader final :public ShaderBase<FlatShader>
 {
 public:
+	FlatShader(const RenderContext& InContext) : ShaderBase(InContext) {};
 	virtual ~FlatShader() {};
 
-	virtual Vec3f Vertex(int InFaceIndex, int InVertexIndex) override
+	virtual Mat41 Vertex(int InFaceIndex, int InVertexIndex) override
 	{
-		Vec3f FaceVertex = ModelData->vert(InFaceIndex, InVertexIndex);
+		Vec3f FaceVertex = Context->ModelData->vert(InFaceIndex, InVertexIndex);
 		VaryingTriangle[InVertexIndex] = FaceVertex;
-		FaceVertex = Transform::Matrix2Vec(VPMatrix*Projection*ModelView*Transform::Vec2Matrix(FaceVertex));
+		Mat41 Position = Context->VPMatrix*Context->Projection*Context->ModelView*Transform::Vec2Matrix(FaceVertex);
 
-		return FaceVertex;
+		return Position;
+	}
+
+	// whole face has one color, so compute it once here.
+	virtual void SetupTriangle() override
+	{
+		Vec3f FaceNormal = cross(VaryingTriangle[2] - VaryingTriangle[0], VaryingTriangle[1] - VaryingTriangle[0]).normalize();
+		float FaceIntensity = std::max(0.f, Context->LightDir*FaceNormal);
+		FaceColor = TGAColor(255, 255, 255)*FaceIntensity;
 	}
 
 	virtual bool Fragment(Vec3f InBarycentric, TGAColor& OutColor) override
 	{		
-		Vec3f FaceNormal = cross(VaryingTriangle[2] - VaryingTriangle[0], VaryingTriangle[1] - VaryingTriangle[0]).normalize();
-		float InterpolatedIntensity = std::max(0.f, LightDir*FaceNormal);
-		OutColor = TGAColor(255, 255, 255)*InterpolatedIntensity;
+		OutColor = FaceColor;
 		return false;
 	}
 
 private:
 	Vec3f VaryingIntensity;
 	Vec3f VaryingTriangle[3]; // triangel's vertex to compute face normal(instead of using vertex normal) to get same color of this face (flat shading).
+	TGAColor FaceColor;
 };
 
 // Gouraud Shader
-class GouraudShader :public IShader
+class GouraudShader final :public ShaderBase<GouraudShader>
 {
 public:
+	GouraudShader(const RenderContext& InContext) : ShaderBase(InContext) {};
 	virtual ~GouraudShader() {};
 
-	virtual Vec3f Vertex(int InFaceIndex, int InVertexIndex) override
+	virtual Mat41 Vertex(int InFaceIndex, int InVertexIndex) override
 	{
-		Vec3f FaceVertex = ModelData->vert(InFaceIndex, InVertexIndex);
-		FaceVertex = Transform::Matrix2Vec(VPMatrix*Projection*ModelView*Transform::Vec2Matrix(FaceVertex));
-		Vec3f VertexNormal = ModelData->norm(InFaceIndex, InVertexIndex);
+		Vec3f FaceVertex = Context->ModelData->vert(InFaceIndex, InVertexIndex);
+		Mat41 Position = Context->VPMatrix*Context->Projection*Context->ModelView*Transform::Vec2Matrix(FaceVertex);
+		Vec3f VertexNormal = Context->ModelData->norm(InFaceIndex, InVertexIndex);
 		// still compute light intensity per vertex.
-		VaryingIntensity.raw[InVertexIndex] = std::max(0.f, LightDir*VertexNormal);
-		return FaceVertex;
+		VaryingIntensity.raw[InVertexIndex] = std::max(0.f, Context->LightDir*VertexNormal);
+		return Position;
 	}
 
 	virtual bool Fragment(Vec3f InBarycentric, TGAColor& OutColor) override
@@ -76,18 +137,19 @@ private:
 };
 
 // Toon Shader
-class ToonShader :public IShader
+class ToonShader final :public ShaderBase<ToonShader>
 {
 public:
+	ToonShader(const RenderContext& InContext) : ShaderBase(InContext) {};
 	virtual ~ToonShader() {};
 
-	virtual Vec3f Vertex(int InFaceIndex, int InVertexIndex) override
+	virtual Mat41 Vertex(int InFaceIndex, int InVertexIndex) override
 	{
-		Vec3f FaceVertex = ModelData->vert(InFaceIndex, InVertexIndex);
-		FaceVertex = Transform::Matrix2Vec(VPMatrix*Projection*ModelView*Transform::Vec2Matrix(FaceVertex));
-		Vec3f VertexNormal = ModelData->norm(InFaceIndex, InVertexIndex);
-		VaryingIntensity.raw[InVertexIndex] = std::max(0.f, LightDir*VertexNormal);
-		return FaceVertex;
+		Vec3f FaceVertex = Context->ModelData->vert(InFaceIndex, InVertexIndex);
+		Mat41 Position = Context->VPMatrix*Context->Projection*Context->ModelView*Transform::Vec2Matrix(FaceVertex);
+		Vec3f VertexNormal = Context->ModelData->norm(InFaceIndex, InVertexIndex);
+		VaryingIntensity.raw[InVertexIndex] = std::max(0.f, Context->LightDir*VertexNormal);
+		return Position;
 	}
 
 	virtual bool Fragment(Vec3f InBarycentric, TGAColor& OutColor) override
@@ -127,22 +189,42 @@ private:
 };
 
 // Gouraud Shader with uv
-class GouraudShader_Diffuse :public IShader
+class GouraudShader_Diffuse final :public ShaderBase<GouraudShader_Diffuse>
 {
 public:
+	GouraudShader_Diffuse(const RenderContext& InContext) : ShaderBase(InContext) {};
 	virtual ~GouraudShader_Diffuse() {};
 
-	virtual Vec3f Vertex(int InFaceIndex, int InVertexIndex) override
+	// output of vertex shader for one vertex, see HasVertexOut.
+	struct VertexOut
 	{
-		Vec3f FaceVertex = ModelData->vert(InFaceIndex, InVertexIndex);
-		FaceVertex = Transform::Matrix2Vec(VPMatrix*Projection*ModelView*Transform::Vec2Matrix(FaceVertex));
-		Vec3f VertexNormal = ModelData->norm(InFaceIndex, InVertexIndex);
+		Mat41 Position; // homogeneous screen position, see IShader::Vertex
+		float Intensity;
+		Vec2f UV;
+	};
+
+	void ShadeVertex(int InVertexIndex, VertexOut& OutVertex)
+	{
+		Vec3f FaceVertex = Context->ModelData->vert(InVertexIndex);
+		OutVertex.Position = Context->VPMatrix*Context->Projection*Context->ModelView*Transform::Vec2Matrix(FaceVertex);
+		Vec3f VertexNormal = Context->ModelData->norm(InVertexIndex);
 		// still compute light intensity per vertex.
-		VaryingIntensity.raw[InVertexIndex] = std::max(0.f, LightDir*VertexNormal);
+		OutVertex.Intensity = std::max(0.f, Context->LightDir*VertexNormal);
+		OutVertex.UV = Context->ModelData->uv(InVertexIndex);
+	}
 
-		UVs[InVertexIndex] = ModelData->uv(InFaceIndex, InVertexIndex);
+	void SetCorner(int InCorner, const VertexOut& InVertex)
+	{
+		VaryingIntensity.raw[InCorner] = InVertex.Intensity;
+		UVs[InCorner] = InVertex.UV;
+	}
 
-		return FaceVertex;
+	virtual Mat41 Vertex(int InFaceIndex, int InVertexIndex) override
+	{
+		VertexOut Out;
+		ShadeVertex(Context->ModelData->vert_index(InFaceIndex, InVertexIndex), Out);
+		SetCorner(InVertexIndex, Out);
+		return Out.Position;
 	}
 
 	virtual bool Fragment(Vec3f InBarycentric, TGAColor& OutColor) override
@@ -155,7 +237,7 @@ public:
 			UVs[1].y * InBarycentric.y +
 			UVs[2].y * InBarycentric.z;
 
-		TGAColor BaseColor = ModelData->diffuse(InterpolatedUV);
+		TGAColor BaseColor = Context->ModelData->diffuse(InterpolatedUV);
 
 		float InterpolatedIntensity = VaryingIntensity*InBarycentric;
 		OutColor = BaseColor*InterpolatedIntensity;
@@ -172,18 +254,19 @@ private:
 // Gouraud Shader with normal mapping/specular mapping.
 // previous method is to use normal data of each vertex and interpolate pixel's normal.
 // if normal data of each pixel is stored in normal map, then we can use directly.
-class GouraudShader_NormalMapping :public IShader
+class GouraudShader_NormalMapping final :public ShaderBase<GouraudShader_NormalMapping>
 {
 public:
+	GouraudShader_NormalMapping(const RenderContext& InContext) : ShaderBase(InContext) {};
 	virtual ~GouraudShader_NormalMapping() {};
 
-	virtual Vec3f Vertex(int InFaceIndex, int InVertexIndex) override
+	virtual Mat41 Vertex(int InFaceIndex, int InVertexIndex) override
 	{
-		Vec3f FaceVertex = ModelData->vert(InFaceIndex, InVertexIndex);
-		FaceVertex = Transform::Matrix2Vec(VPMatrix*Projection*ModelView*Transform::Vec2Matrix(FaceVertex));
+		Vec3f FaceVertex = Context->ModelData->vert(InFaceIndex, InVertexIndex);
+		Mat41 Position = Context->VPMatrix*Context->Projection*Context->ModelView*Transform::Vec2Matrix(FaceVertex);
 
-		UVs[InVertexIndex] = ModelData->uv(InFaceIndex, InVertexIndex);
-		return FaceVertex;
+		UVs[InVertexIndex] = Context->ModelData->uv(InFaceIndex, InVertexIndex);
+		return Position;
 	}
 
 	virtual bool Fragment(Vec3f InBarycentric, TGAColor& OutColor) override
@@ -196,15 +279,15 @@ public:
 			UVs[1].y * InBarycentric.y +
 			UVs[2].y * InBarycentric.z;
 
-		TGAColor BaseColor = ModelData->diffuse(InterpolatedUV);
+		TGAColor BaseColor = Context->ModelData->diffuse(InterpolatedUV);
 
 		// transform normals from normal map
 		// note normal map here is stored per pixel...so obtain pixel's normal directly and compute light intensity.
 		// this normal map is stored in model coordinates, NOT tangent space.
 		// to get normal in projection space, we need to recompute normal, it is inverse transposed matrix to keep it still "normal".
-		Vec3f TransformNormal =  Transform::Matrix2Vec(Uniform_MIT*Transform::Vec2Matrix(ModelData->normal(InterpolatedUV))).normalize();
+		Vec3f TransformNormal =  Transform::Matrix2Vec(Context->Uniform_MIT*Transform::Vec2Matrix(Context->ModelData->normal(InterpolatedUV))).normalize();
 		// for light vector, we apply projection transform to it, note it is different from normal vector transform.
-		Vec3f TransformLight = Transform::Matrix2Vec(Uniform_M*Transform::Vec2Matrix(LightDir)).normalize();
+		Vec3f TransformLight = Transform::Matrix2Vec(Context->Uniform_M*Transform::Vec2Matrix(Context->LightDir)).normalize();
 
 		// phong light model
 		float AmbientLight = 5.;
@@ -212,7 +295,7 @@ public:
 		// specular mapping texture stores the value of each pixel's glossy factor.
 		// compute reflected light
 		Vec3f ReflectedLight = (TransformNormal*(TransformNormal*TransformLight*2.f) - TransformLight).normalize();
-		float SpecularIntensity = std::pow(std::max(0.f, ReflectedLight.z), ModelData->specular(InterpolatedUV));
+		float SpecularIntensity = std::pow(std::max(0.f, ReflectedLight.z), Context->ModelData->specular(InterpolatedUV));
 		// diffuse intensity
 		float DiffuseIntensity = std::max(0.f, TransformNormal*TransformLight);
 
@@ -230,25 +313,89 @@ private:
 // Phong Shading.
 // Gouraud shading is calculate light per vertex and then do interpolation.
 // Phong shading is calculate light per pixel.
-class PhongShader :public IShader
+class PhongShader final :public ShaderBase<PhongShader>
 {
 public:
+	PhongShader(const RenderContext& InContext) : ShaderBase(InContext) {};
 	virtual ~PhongShader() {};
 
-	virtual Vec3f Vertex(int InFaceIndex, int InVertexIndex) override
+	// output of vertex shader for one vertex, see HasVertexOut.
+	struct VertexOut
+	{
+		Mat41 Position; // homogeneous screen position, see IShader::Vertex
+		Vec3f ViewPosition;
+		Vec3f Normal;
+		Vec2f UV;
+	};
+
+	void ShadeVertex(int InVertexIndex, VertexOut& OutVertex)
 	{
-		Vec3f FaceVertex = ModelData->vert(InFaceIndex, InVertexIndex);
+		Vec3f FaceVertex = Context->ModelData->vert(InVertexIndex);
 
 		// store triangle's vertices in view space.
-		VaryingTriangle[InVertexIndex] = Transform::Matrix2Vec(Uniform_M*Transform::Vec2Matrix(FaceVertex));
+		OutVertex.ViewPosition = Transform::Matrix2Vec(Context->Uniform_M*Transform::Vec2Matrix(FaceVertex));
 
-		FaceVertex = Transform::Matrix2Vec(VPMatrix*Uniform_M*Transform::Vec2Matrix(FaceVertex));
+		OutVertex.Position = Context->VPMatrix*Context->Uniform_M*Transform::Vec2Matrix(FaceVertex);
 
 		// here stores vertex normals from view space.
-		VaryingNormals[InVertexIndex] = Transform::Matrix2VecForV(Uniform_MIT*Transform::Vec2Matrix(ModelData->norm(InFaceIndex, InVertexIndex), 0.f)).normalize();
+		OutVertex.Normal = Transform::Matrix2VecForV(Context->Uniform_MIT*Transform::Vec2Matrix(Context->ModelData->norm(InVertexIndex), 0.f)).normalize();
+
+		OutVertex.UV = Context->ModelData->uv(InVertexIndex);
+	}
+
+	void SetCorner(int InCorner, const VertexOut& InVertex)
+	{
+		VaryingTriangle[InCorner] = InVertex.ViewPosition;
+		VaryingNormals[InCorner] = InVertex.Normal;
+		VaryingUVs[InCorner] = InVertex.UV;
+	}
+
+	virtual Mat41 Vertex(int InFaceIndex, int InVertexIndex) override
+	{
+		VertexOut Out;
+		ShadeVertex(Context->ModelData->vert_index(InFaceIndex, InVertexIndex), Out);
+		SetCorner(InVertexIndex, Out);
+		return Out.Position;
+	}
+
+	// tangent space basis of the triangle.
+	// now we need transform pixel normal in normal map from tangent space to world space.
+	// so first we need to know how tangent space basis(TBN coordinates) represented in world space.
+	// then TBN matrix(3*3) [tranform tangent basis in world] multiply with Normal in tangent space, to get normal in world.
+
+	// we have world vertex coordinates vt0, vt1, vt2, and its uv coordinates uv0, uv1, uv2.
+	// note uv coordinates is defined in tangent space. u is along tangent direction, v is bitangent direction.
+	// triangle's two edge (vt1-vt0) and (vt2-vt0) can be described in TBN coordinates. N is vertical to triangle's plane.
+	// (vt1-vt0) = (u1-u0)*T + (v1-v0)*B + 0*N = (uv1.x-uv0.x)*T + (uv1.y-uv0.y)*B
+	// (vt2-vt0) = (u2-u0)*T + (v2-v0)*B + 0*N = (uv2.x-uv0.x)*T + (uv2.y-uv0.y)*B
+	// pixel's normal(InterpolatedNormal) is as N axis, so
+	// InterpolatedNormal = 0*T + 0*B + N
+	// now we can construct matrix to compute basis for TBN. and also since we need all vertices of this triangle,
+	// we need to store them in vertex shader stage.
+	// the matrix is like: 3 vector in world(3*3) = 3 vector in uv(tangent) space(3*3) * TBN basis in world(3*3)
+	// N axis is (0,0,1) in tangent frame, so (Tri_T)^-1 keeps N apart from T and B:
+	// T and B rows of TBN only depend on the triangle and are computed here once, N is the pixel's interpolated normal.
+	virtual void SetupTriangle() override
+	{
+		// we have triangle in world coordinates. Tri_W
+		// we must normalize matrix, why?
+		Vec3f Edge1 = (VaryingTriangle[1] - VaryingTriangle[0]).normalize();
+		Vec3f Edge2 = (VaryingTriangle[2] - VaryingTriangle[0]).normalize();
+
+		// also have triangle in tangent space. Tri_T
+		Mat3 TriangleTangent;
+		TriangleTangent.SetRow(0, Vec3f(VaryingUVs[1] - VaryingUVs[0]).normalize());
+		TriangleTangent.SetRow(1, Vec3f(VaryingUVs[2] - VaryingUVs[0]).normalize());
+		TriangleTangent.SetRow(2, Vec3f(0, 0, 1));// note here TBN is ortho coordinate, N axis is (0,0,1) in this frame.
+
+		// Define TBN_toW, Tri_W = Tri_T * TBN_toW. // why not Tri_W =  TBN_toW * Tri_T????
+		// TBN_toW = (Tri_T)^-1 * Tri_W.
+		Mat3 InvTriangleTangent = TriangleTangent.Inverse();
+		TangentInWorld = Edge1*InvTriangleTangent[0][0] + Edge2*InvTriangleTangent[0][1];
+		BitangentInWorld = Edge1*InvTriangleTangent[1][0] + Edge2*InvTriangleTangent[1][1];
 
-		VaryingUVs[InVertexIndex] = ModelData->uv(InFaceIndex, InVertexIndex);
-		return FaceVertex;
+		// don't forget to transform light to view space.
+		TransformLight = Transform::Matrix2VecForV(Context->Uniform_M*Transform::Vec2Matrix(Context->LightDir, 0.f)).normalize();
 	}
 
 	virtual bool Fragment(Vec3f InBarycentric, TGAColor& OutColor) override
@@ -276,50 +423,50 @@ public:
 			VaryingNormals[2].z * InBarycentric.z;
 		//InterpolatedNormal.normalize();
 
-		// now we need transform pixel normal in normal map from tangent space to world space.
-		// so first we need to know how tangent space basis(TBN coordinates) represented in world space.
-		// then TBN matrix(3*3) [tranform tangent basis in world] multiply with Normal in tangent space, to get normal in world.
-
-		// we have world vertex coordinates vt0, vt1, vt2, and its uv coordinates uv0, uv1, uv2.
-		// note uv coordinates is defined in tangent space. u is along tangent direction, v is bitangent direction.
-		// triangle's two edge (vt1-vt0) and (vt2-vt0) can be described in TBN coordinates. N is vertical to triangle's plane.
-		// (vt1-vt0) = (u1-u0)*T + (v1-v0)*B + 0*N = (uv1.x-uv0.x)*T + (uv1.y-uv0.y)*B
-		// (vt2-vt0) = (u2-u0)*T + (v2-v0)*B + 0*N = (uv2.x-uv0.x)*T + (uv2.y-uv0.y)*B
-		// pixel's normal(InterpolatedNormal) is as N axis, so
-		// InterpolatedNormal = 0*T + 0*B + N
-		// now we can construct matrix to compute basis for TBN. and also since we need all vertices of this triangle,
-		// we need to store them in vertex shader stage.
-		// the matrix is like: 3 vector in world(3*3) = 3 vector in uv(tangent) space(3*3) * TBN basis in world(3*3)
-
-		// we have triangle in world coordinates. Tri_W
-		// we must normalize matrix, why?
-		Matrix TriangleInWorld(3, 3);
-		TriangleInWorld.SetRow(0, (VaryingTriangle[1] - VaryingTriangle[0]).normalize());
-		TriangleInWorld.SetRow(1, (VaryingTriangle[2] - VaryingTriangle[0]).normalize());
-		TriangleInWorld.SetRow(2, InterpolatedNormal.normalize());
-
-		// also have triangle in tangent space. Tri_T
-		Matrix TriangleTangent(3, 3);
-		TriangleTangent.SetRow(0, Vec3f(VaryingUVs[1] - VaryingUVs[0]).normalize());
-		TriangleTangent.SetRow(1, Vec3f(VaryingUVs[2] - VaryingUVs[0]).normalize());
-		TriangleTangent.SetRow(2, Vec3f(0, 0, 1));// note here TBN is ortho coordinate, N axis is (0,0,1) in this frame.
+		return ShadePixel(InterpolatedUV, InterpolatedNormal, nullptr, OutColor);
+	}
 
-		// Define TBN_toW, Tri_W = Tri_T * TBN_toW. // why not Tri_W =  TBN_toW * Tri_T????
-		// TBN_toW = (Tri_T)^-1 * Tri_W.
-		Matrix TBN(3, 3);
-		TBN = TriangleTangent.Inverse()*TriangleInWorld;
+	// same as Fragment for all lanes of a block: interpolate varyings for 8 pixels at once, then shade live ones.
+	unsigned FragmentBlock(const BarycentricBlock& InBlock, TGAColor* OutColors)
+	{
+		const int Size = BarycentricBlock::Size;
+		float U[Size], V[Size], NX[Size], NY[Size], NZ[Size];
+		InBlock.Interpolate(VaryingUVs[0].x, VaryingUVs[1].x, VaryingUVs[2].x, U);
+		InBlock.Interpolate(VaryingUVs[0].y, VaryingUVs[1].y, VaryingUVs[2].y, V);
+		InBlock.Interpolate(VaryingNormals[0].x, VaryingNormals[1].x, VaryingNormals[2].x, NX);
+		InBlock.Interpolate(VaryingNormals[0].y, VaryingNormals[1].y, VaryingNormals[2].y, NY);
+		InBlock.Interpolate(VaryingNormals[0].z, VaryingNormals[1].z, VaryingNormals[2].z, NZ);
+		float DUDX[Size], DUDY[Size], DVDX[Size], DVDY[Size];
+		InBlock.QuadDerivatives(VaryingUVs[0].x, VaryingUVs[1].x, VaryingUVs[2].x, U, DUDX, DUDY);
+		InBlock.QuadDerivatives(VaryingUVs[0].y, VaryingUVs[1].y, VaryingUVs[2].y, V, DVDX, DVDY);
+
+		unsigned Discarded = 0;
+		for (unsigned Live = InBlock.LiveMask; Live; Live &= Live - 1)
+		{
+			int Lane = RasterKernel::LowestLane(Live);
+			const Vec2f UVDerivatives[2] = { Vec2f(DUDX[Lane], DVDX[Lane]), Vec2f(DUDY[Lane], DVDY[Lane]) };
+			if (ShadePixel(Vec2f(U[Lane], V[Lane]), Vec3f(NX[Lane], NY[Lane], NZ[Lane]), UVDerivatives, OutColors[Lane]))
+			{
+				Discarded |= 1u << Lane;
+			}
+		}
+		return Discarded;
+	}
 
-		Matrix NormalInWorldM(1, 3);
-		// compute normal data in world coordinate, note matrix multiplication order matters!!
-		NormalInWorldM = Transform::Vec2Matrix13(ModelData->normal(InterpolatedUV))*TBN;
-		Vec3f NormalInWorld(NormalInWorldM[0][0], NormalInWorldM[0][1], NormalInWorldM[0][2]);
+private:
+	// per pixel part of fragment shader, given interpolated uv and normal.
+	// InUVDerivatives are the uv derivatives along screen x and y to filter textures with, FragmentBlock takes them from
+	// the quads of the block. the per pixel Fragment has no neighbours to take them from, passes nullptr and reads the nearest texel.
+	bool ShadePixel(Vec2f InterpolatedUV, Vec3f InterpolatedNormal, const Vec2f* InUVDerivatives, TGAColor& OutColor)
+	{
+		// compute normal data in world coordinate: Normal in tangent space(1*3) * TBN(3*3).
+		Vec3f NormalInTangent = InUVDerivatives ? Context->ModelData->normal(InterpolatedUV, InUVDerivatives[0], InUVDerivatives[1]) : Context->ModelData->normal(InterpolatedUV);
+		Vec3f NormalInWorld = TangentInWorld*NormalInTangent.x + BitangentInWorld*NormalInTangent.y + InterpolatedNormal.normalize()*NormalInTangent.z;
 		NormalInWorld.normalize();
 
-		// don't forget to transform light to view space.
-		Vec3f TransformLight = Transform::Matrix2VecForV(Uniform_M*Transform::Vec2Matrix(LightDir, 0.f)).normalize();
 		float Intensity = std::max(0.f, NormalInWorld*TransformLight);
 		//float Intensity = std::max(0.f, InterpolatedNormal*TransformLight);// this one using interpolated normal for pixel, but not use normal map data.
-		TGAColor BaseColor = ModelData->diffuse(InterpolatedUV);
+		TGAColor BaseColor = InUVDerivatives ? Context->ModelData->diffuse(InterpolatedUV, InUVDerivatives[0], InUVDerivatives[1]) : Context->ModelData->diffuse(InterpolatedUV);
 		//TGAColor BaseColor = TGAColor(255, 255, 255);
 		OutColor = BaseColor*Intensity;
 
@@ -328,28 +475,51 @@ public:
 		return false;
 	}
 
-private:
 	Vec2f VaryingUVs[3];
 	Vec3f VaryingNormals[3];
 
 	Vec3f VaryingTriangle[3];
+
+	// computed by triangle setup.
+	Vec3f TangentInWorld;
+	Vec3f BitangentInWorld;
+	Vec3f TransformLight;
 };
 
 // Depth shader
-class DepthShader :public IShader
+class DepthShader final :public ShaderBase<DepthShader>
 {
 public:
+	DepthShader(const RenderContext& InContext) : ShaderBase(InContext) {};
 	virtual ~DepthShader() {};
 
-	virtual Vec3f Vertex(int InFaceIndex, int InVertexIndex) override
+	// output of vertex shader for one vertex, see HasVertexOut.
+	struct VertexOut
 	{
-		Vec3f FaceVertex = ModelData->vert(InFaceIndex, InVertexIndex);
+		Mat41 Position; // homogeneous screen position, see IShader::Vertex
+		Vec3f ViewPosition;
+	};
+
+	void ShadeVertex(int InVertexIndex, VertexOut& OutVertex)
+	{
+		Vec3f FaceVertex = Context->ModelData->vert(InVertexIndex);
 
 		// store triangle's vertices in view space.
-		VaryingTriangle[InVertexIndex] = Transform::Matrix2Vec(Uniform_M*Transform::Vec2Matrix(FaceVertex));
-		FaceVertex = Transform::Matrix2Vec(VPMatrix*Uniform_M*Transform::Vec2Matrix(FaceVertex));
+		OutVertex.ViewPosition = Transform::Matrix2Vec(Context->Uniform_M*Transform::Vec2Matrix(FaceVertex));
+		OutVertex.Position = Context->VPMatrix*Context->Uniform_M*Transform::Vec2Matrix(FaceVertex);
+	}
 
-		return FaceVertex;
+	void SetCorner(int InCorner, const VertexOut& InVertex)
+	{
+		VaryingTriangle[InCorner] = InVertex.ViewPosition;
+	}
+
+	virtual Mat41 Vertex(int InFaceIndex, int InVertexIndex) override
+	{
+		VertexOut Out;
+		ShadeVertex(Context->ModelData->vert_index(InFaceIndex, InVertexIndex), Out);
+		SetCorner(InVertexIndex, Out);
+		return Out.Position;
 	}
 
 	// currently this depth fragment shader is just for output depth image.
@@ -378,23 +548,42 @@ private:
 	Vec3f VaryingTriangle[3];
 };
 
-class ShadowShader :public IShader
+class ShadowShader final :public ShaderBase<ShadowShader>
 {
 public:
-	ShadowShader(Matrix InShadowM, Matrix InShadowMIT, Matrix InFrameToShadowM, float* InShadowBuffer) :
-		Uniform_Shadow_M(InShadowM), Uniform_Shadow_MIT(InShadowMIT), Uniform_FrameToShadow_M(InFrameToShadowM), ShadowBuffer(InShadowBuffer) {};
+	ShadowShader(const RenderContext& InContext, const Mat4& InShadowM, const Mat4& InShadowMIT, const Mat4& InFrameToShadowM, float* InShadowBuffer) :
+		ShaderBase(InContext), Uniform_Shadow_M(InShadowM), Uniform_Shadow_MIT(InShadowMIT), Uniform_FrameToShadow_M(InFrameToShadowM), ShadowBuffer(InShadowBuffer) {};
 
 	virtual ~ShadowShader() {};
 
-	virtual Vec3f Vertex(int InFaceIndex, int InVertexIndex) override
+	// output of vertex shader for one vertex, see HasVertexOut.
+	struct VertexOut
 	{
-		Vec3f FaceVertex = ModelData->vert(InFaceIndex, InVertexIndex);
+		Mat41 Position; // homogeneous screen position, see IShader::Vertex
+		Vec2f UV;
+	};
 
-		FaceVertex = Transform::Matrix2Vec(VPMatrix*Uniform_Shadow_M*Transform::Vec2Matrix(FaceVertex));
-		VaryingTriangle[InVertexIndex] = FaceVertex;
+	void ShadeVertex(int InVertexIndex, VertexOut& OutVertex)
+	{
+		Vec3f FaceVertex = Context->ModelData->vert(InVertexIndex);
 
-		VaryingUVs[InVertexIndex] = ModelData->uv(InFaceIndex, InVertexIndex);
-		return FaceVertex;
+		OutVertex.Position = Context->VPMatrix*Uniform_Shadow_M*Transform::Vec2Matrix(FaceVertex);
+		OutVertex.UV = Context->ModelData->uv(InVertexIndex);
+	}
+
+	void SetCorner(int InCorner, const VertexOut& InVertex)
+	{
+		VaryingTriangle[InCorner] = Transform::Matrix2VecForV(InVertex.Position);
+		VaryingW.raw[InCorner] = InVertex.Position[3][0];
+		VaryingUVs[InCorner] = InVertex.UV;
+	}
+
+	virtual Mat41 Vertex(int InFaceIndex, int InVertexIndex) override
+	{
+		VertexOut Out;
+		ShadeVertex(Context->ModelData->vert_index(InFaceIndex, InVertexIndex), Out);
+		SetCorner(InVertexIndex, Out);
+		return Out.Position;
 	}
 
 	virtual bool Fragment(Vec3f InBarycentric, TGAColor& OutColor) override
@@ -409,14 +598,7 @@ public:
 		InterpolatedVertex.z = VaryingTriangle[0].z*InBarycentric.x +
 			VaryingTriangle[1].z*InBarycentric.y +
 			VaryingTriangle[2].z*InBarycentric.z;
-
-		// we have screen coordinates in frame buffer(FaceVertex), now transform it to screen coordinates of shadow buffer.
-		Vec3f VertexInShadowBuffer = Transform::Matrix2Vec(Uniform_FrameToShadow_M*Transform::Vec2Matrix(InterpolatedVertex));
-		// then we can get shadow buffer index.
-		int ShadowBufferIndex = (int)VertexInShadowBuffer.x + (int)VertexInShadowBuffer.y*Width;
-		// we get current pixel's depth in screen buffer, if corresponding pixel in shadow buffer is less, then this pixel should be lit. 
-		// why????
-		float Shadow = 0.3f + 0.7f*(ShadowBuffer[ShadowBufferIndex] < VertexInShadowBuffer.z);
+		InterpolatedVertex = InterpolatedVertex*(1.f / (VaryingW*InBarycentric));
 
 		Vec2f InterpolatedUV;
 		InterpolatedUV.x = VaryingUVs[0].x * InBarycentric.x +
@@ -425,19 +607,68 @@ public:
 		InterpolatedUV.y = VaryingUVs[0].y * InBarycentric.x +
 			VaryingUVs[1].y * InBarycentric.y +
 			VaryingUVs[2].y * InBarycentric.z;
-		
+
+		return ShadePixel(InterpolatedVertex, InterpolatedUV, nullptr, OutColor);
+	}
+
+	// same as Fragment for all lanes of a block: interpolate varyings for 8 pixels at once, then shade live ones.
+	unsigned FragmentBlock(const BarycentricBlock& InBlock, TGAColor* OutColors)
+	{
+		const int Size = BarycentricBlock::Size;
+		float X[Size], Y[Size], Z[Size], W[Size], U[Size], V[Size];
+		InBlock.Interpolate(VaryingTriangle[0].x, VaryingTriangle[1].x, VaryingTriangle[2].x, X);
+		InBlock.Interpolate(VaryingTriangle[0].y, VaryingTriangle[1].y, VaryingTriangle[2].y, Y);
+		InBlock.Interpolate(VaryingTriangle[0].z, VaryingTriangle[1].z, VaryingTriangle[2].z, Z);
+		InBlock.Interpolate(VaryingW.x, VaryingW.y, VaryingW.z, W);
+		InBlock.Interpolate(VaryingUVs[0].x, VaryingUVs[1].x, VaryingUVs[2].x, U);
+		InBlock.Interpolate(VaryingUVs[0].y, VaryingUVs[1].y, VaryingUVs[2].y, V);
+		float DUDX[Size], DUDY[Size], DVDX[Size], DVDY[Size];
+		InBlock.QuadDerivatives(VaryingUVs[0].x, VaryingUVs[1].x, VaryingUVs[2].x, U, DUDX, DUDY);
+		InBlock.QuadDerivatives(VaryingUVs[0].y, VaryingUVs[1].y, VaryingUVs[2].y, V, DVDX, DVDY);
+
+		unsigned Discarded = 0;
+		for (unsigned Live = InBlock.LiveMask; Live; Live &= Live - 1)
+		{
+			int Lane = RasterKernel::LowestLane(Live);
+			const Vec2f UVDerivatives[2] = { Vec2f(DUDX[Lane], DVDX[Lane]), Vec2f(DUDY[Lane], DVDY[Lane]) };
+			if (ShadePixel(Vec3f(X[Lane], Y[Lane], Z[Lane])*(1.f / W[Lane]), Vec2f(U[Lane], V[Lane]), UVDerivatives, OutColors[Lane]))
+			{
+				Discarded |= 1u << Lane;
+			}
+		}
+		return Discarded;
+	}
+
+private:
+	// per pixel part of fragment shader, given interpolated screen position and uv.
+	// InUVDerivatives filter the textures as in PhongShader, nullptr reads the nearest texel.
+	bool ShadePixel(Vec3f InterpolatedVertex, Vec2f InterpolatedUV, const Vec2f* InUVDerivatives, TGAColor& OutColor)
+	{
+		// we have screen coordinates in frame buffer(FaceVertex), now transform it to screen coordinates of shadow buffer.
+		Vec3f VertexInShadowBuffer = Transform::Matrix2Vec(Uniform_FrameToShadow_M*Transform::Vec2Matrix(InterpolatedVertex));
+		// then we can get shadow buffer index.
+		int ShadowBufferIndex = (int)VertexInShadowBuffer.x + (int)VertexInShadowBuffer.y*Context->Width;
+		// we get current pixel's depth in screen buffer, if corresponding pixel in shadow buffer is less, then this pixel should be lit. 
+		// why????
+		float Shadow = 0.3f + 0.7f*(ShadowBuffer[ShadowBufferIndex] < VertexInShadowBuffer.z);
+
+		// texture reads, see InUVDerivatives.
+		Model* ModelData = Context->ModelData;
+		Vec3f MappedNormal = InUVDerivatives ? ModelData->normal(InterpolatedUV, InUVDerivatives[0], InUVDerivatives[1]) : ModelData->normal(InterpolatedUV);
+		float SpecularPower = InUVDerivatives ? ModelData->specular(InterpolatedUV, InUVDerivatives[0], InUVDerivatives[1]) : ModelData->specular(InterpolatedUV);
+		TGAColor BaseColor = InUVDerivatives ? ModelData->diffuse(InterpolatedUV, InUVDerivatives[0], InUVDerivatives[1]) : ModelData->diffuse(InterpolatedUV);
+
 		// use normal map in world space.
-		Vec3f TransformNormal = Transform::Matrix2Vec(Uniform_Shadow_MIT*Transform::Vec2Matrix(ModelData->normal(InterpolatedUV))).normalize();
-		Vec3f TransformLight = Transform::Matrix2Vec(Uniform_Shadow_M*Transform::Vec2Matrix(LightDir)).normalize();
+		Vec3f TransformNormal = Transform::Matrix2Vec(Uniform_Shadow_MIT*Transform::Vec2Matrix(MappedNormal)).normalize();
+		Vec3f TransformLight = Transform::Matrix2Vec(Uniform_Shadow_M*Transform::Vec2Matrix(Context->LightDir)).normalize();
 
 		float AmbientLight = 20.;
 		// compute reflected light
 		Vec3f ReflectedLight = (TransformNormal*(TransformNormal*TransformLight*2.f) - TransformLight).normalize();
-		float SpecularIntensity = std::pow(std::max(0.f, ReflectedLight.z), ModelData->specular(InterpolatedUV));
+		float SpecularIntensity = std::pow(std::max(0.f, ReflectedLight.z), SpecularPower);
 		// diffuse intensity
 		float DiffuseIntensity = std::max(0.f, TransformNormal*TransformLight);
 
-		TGAColor BaseColor = ModelData->diffuse(InterpolatedUV);
 		for (int Idx = 0; Idx < 3; Idx++)
 		{
 			OutColor.bgra[Idx] = std::min<float>(AmbientLight + BaseColor.bgra[Idx] * Shadow* (1.2*DiffuseIntensity + 0.6*SpecularIntensity), 255);
@@ -445,12 +676,14 @@ public:
 		return false;
 	}
 
-private:
-	Matrix Uniform_Shadow_M;
-	Matrix Uniform_Shadow_MIT;
-	Matrix Uniform_FrameToShadow_M; // transform framebuffer screen coordinates to shadowbuffer screen coordinates
+	Mat4 Uniform_Shadow_M;
+	Mat4 Uniform_Shadow_MIT;
+	Mat4 Uniform_FrameToShadow_M; // transform framebuffer screen coordinates to shadowbuffer screen coordinates
 	Vec2f VaryingUVs[3];
+	// homogeneous screen position of the corners, x/y/z and w. it is linear in the barycentric coordinates
+	// the rasterizer hands out (perspective correct), the fragment's screen position is then interpolated x/y/z over w.
 	Vec3f VaryingTriangle[3];
+	Vec3f VaryingW;
 
 	float* ShadowBuffer;
 };
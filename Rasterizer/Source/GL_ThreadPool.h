@@ -0,0 +1,134 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads to run ParallelFor jobs.
+// Threads are created once and sleep between jobs, so a pool can be reused for every pass of every frame.
+// The calling thread works on the job too, so a pool of one thread simply runs everything inline.
+class ThreadPool
+{
+public:
+	// InNumThreads <= 0 means one thread per hardware core.
+	ThreadPool(int InNumThreads = 0) : Job(nullptr), JobCount(0), NextIndex(0), Generation(0), ActiveWorkers(0), bQuit(false)
+	{
+		if (InNumThreads <= 0)
+		{
+			InNumThreads = std::max(1, (int)std::thread::hardware_concurrency());
+		}
+
+		for (int Index = 1; Index < InNumThreads; Index++)
+		{
+			Workers.emplace_back([this]() { WorkerLoop(); });
+		}
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::unique_lock<std::mutex> Lock(Mutex);
+			bQuit = true;
+		}
+		WakeCondition.notify_all();
+		for (std::thread& Worker : Workers)
+		{
+			Worker.join();
+		}
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	int NumThreads() const { return (int)Workers.size() + 1; }
+
+	// call InFunc(Index) for every Index in [0, InCount) spread over all threads, return when all calls are done.
+	// indices are handed out in increasing order, but may complete in any order.
+	void ParallelFor(int InCount, const std::function<void(int)>& InFunc)
+	{
+		if (InCount <= 0)
+		{
+			return;
+		}
+
+		if (Workers.empty() || InCount == 1)
+		{
+			for (int Index = 0; Index < InCount; Index++)
+			{
+				InFunc(Index);
+			}
+			return;
+		}
+
+		{
+			std::unique_lock<std::mutex> Lock(Mutex);
+			Job = &InFunc;
+			JobCount = InCount;
+			NextIndex = 0;
+			Generation++;
+		}
+		WakeCondition.notify_all();
+
+		RunJob();
+
+		// all indices are taken, wait for the workers still busy with theirs.
+		std::unique_lock<std::mutex> Lock(Mutex);
+		DoneCondition.wait(Lock, [this]() { return ActiveWorkers == 0; });
+		Job = nullptr;
+	}
+
+private:
+	void RunJob()
+	{
+		for (int Index = NextIndex++; Index < JobCount; Index = NextIndex++)
+		{
+			(*Job)(Index);
+		}
+	}
+
+	void WorkerLoop()
+	{
+		unsigned SeenGeneration = 0;
+		for (;;)
+		{
+			std::unique_lock<std::mutex> Lock(Mutex);
+			WakeCondition.wait(Lock, [&]() { return bQuit || Generation != SeenGeneration; });
+			if (bQuit)
+			{
+				return;
+			}
+
+			SeenGeneration = Generation;
+			// job may already be finished by other threads when this one wakes up.
+			if (!Job)
+			{
+				continue;
+			}
+
+			ActiveWorkers++;
+			Lock.unlock();
+			RunJob();
+			Lock.lock();
+			if (--ActiveWorkers == 0)
+			{
+				DoneCondition.notify_all();
+			}
+		}
+	}
+
+	std::vector<std::thread> Workers;
+	std::mutex Mutex;
+	std::condition_variable WakeCondition;
+	std::condition_variable DoneCondition;
+
+	const std::function<void(int)>* Job;
+	int JobCount;
+	std::atomic<int> NextIndex;
+	unsigned Generation;
+	int ActiveWorkers;
+	bool bQuit;
+};
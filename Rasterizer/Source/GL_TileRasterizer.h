@@ -0,0 +1,332 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+#include <string.h>
+#include "GL_Triangle.h"
+#include "GL_Clipper.h"
+#include "GL_ThreadPool.h"
+#include "GL_VertexCache.h"
+#include "../Utils/model.h"
+
+// what happened to the triangles of a draw, every submitted triangle is counted in exactly one of the others.
+struct TriangleStats
+{
+	int Submitted = 0;
+	int Culled = 0; // facing away, see ECullMode
+	int Degenerate = 0; // zero area after snapping to the sub-pixel grid
+	int Offscreen = 0; // covers no pixel of the image, or nothing left after clipping
+	int Binned = 0; // handed to the raster pass
+
+	int Clipped = 0; // went through Clipper::Clip, counted in one of the above as well
+
+	void Reset() { *this = TriangleStats(); }
+};
+
+// Binning rasterizer.
+// setup pass: run vertex shader for every face, clip it in homogeneous space, drop culled/degenerated/offscreen
+// triangles, and sort the rest into the screen tiles their bounding box touches.
+// raster pass: worker threads take whole tiles, and rasterize the tile's triangles into tile local depth/color buffers,
+// then copy the tile back to the image.
+// tiles never share a pixel and triangles of a tile are drawn in submission order, so the image is bit-identical
+// to drawing the faces one by one with Triangle::DrawAndFillTriangleWithShader.
+// 1/w of every corner is handed to the rasterizer, so varyings are interpolated perspective correct.
+class TileRasterizer
+{
+public:
+	static const int TileSize = 64;
+	static_assert(TileSize % Triangle::EdgeAnchorSpacing == 0, "tiles must start where rasterizer re-evaluates edge functions");
+
+	// InNumThreads <= 0 means one thread per hardware core.
+	TileRasterizer(int InNumThreads = 0) : Workers(InNumThreads), CullMode(ECullMode::None), bHiZEnabled(false) {}
+
+	int NumThreads() const { return Workers.NumThreads(); }
+
+	// applies to the following draws.
+	void SetCullMode(ECullMode InCullMode) { CullMode = InCullMode; }
+	ECullMode GetCullMode() const { return CullMode; }
+	// each tile keeps a HiZBuffer of its z buffer to skip triangles and 8x8 cells hidden behind what is already drawn.
+	// the image is the same either way. off by default: fragments are shaded only after the per pixel depth test
+	// anyway, so skipping saves coverage and depth tests only, which the models here don't gain back from the
+	// cost of keeping the cells up to date on every depth write (see HiZBenchmark). worth it for scenes with lots
+	// of occluded geometry drawn roughly front to back.
+	void SetHiZEnabled(bool bInEnabled) { bHiZEnabled = bInEnabled; }
+	bool IsHiZEnabled() const { return bHiZEnabled; }
+
+	// vertex shader counters of the last draw.
+	const VertexCacheStats& GetVertexStats() const { return VertexStats; }
+	// triangle counters of the last draw.
+	const TriangleStats& GetTriangleStats() const { return TriStats; }
+	// pixel loop counters of the last draw, summed over tiles.
+	const RasterStats& GetRasterStats() const { return PixelStats; }
+
+	// ShaderType must be the concrete shader class: each triangle keeps a copy of the shader holding the
+	// varyings its vertex shader wrote, fragment shader of that copy is then called (read only) from the worker threads.
+	// every corner of every face is shaded by calling InShader.Vertex(FaceIndex, Corner).
+	template <class ShaderType>
+	void DrawModel(ShaderType& InShader, int InNumFaces, float* InZBuffer, TGAImage& InImage)
+	{
+		VertexStats.Reset();
+		DrawTriangles(InShader, InNumFaces, InZBuffer, InImage, [&](int InFaceIndex, Mat41* OutPositions)
+		{
+			for (int VertexIdx = 0; VertexIdx < 3; VertexIdx++)
+			{
+				OutPositions[VertexIdx] = InShader.Vertex(InFaceIndex, VertexIdx);
+			}
+			VertexStats.Lookups += 3;
+			VertexStats.ShadedVertices += 3;
+		});
+	}
+
+	// draw triangles InIndices[3*i] .. InIndices[3*i+2] (vertex indices of the model the shader reads).
+	// when the shader has a VertexOut (see HasVertexOut), vertex shader outputs go through a post-transform cache,
+	// so a vertex shared with recently drawn triangles is not shaded again. same image as DrawModel.
+	template <class ShaderType>
+	void DrawIndexed(ShaderType& InShader, Span<int> InIndices, float* InZBuffer, TGAImage& InImage)
+	{
+		DrawIndexed(InShader, InIndices, InZBuffer, InImage, HasVertexOut<ShaderType>());
+	}
+
+private:
+	template <class ShaderType>
+	void DrawIndexed(ShaderType& InShader, Span<int> InIndices, float* InZBuffer, TGAImage& InImage, std::true_type)
+	{
+		typedef typename ShaderType::VertexOut VertexOut;
+		// cache as large as the vertex range of the draw, up to its maximum.
+		int NumVertices = 0;
+		for (int Index = 0; Index < InIndices.size(); Index++)
+		{
+			NumVertices = std::max(NumVertices, InIndices[Index] + 1);
+		}
+		VertexCache<VertexOut> Cache(NumVertices);
+		auto ShadeVertex = [&](int InVertexIndex, VertexOut& OutVertex) { InShader.ShadeVertex(InVertexIndex, OutVertex); };
+
+		VertexStats.Reset();
+		DrawTriangles(InShader, InIndices.size() / 3, InZBuffer, InImage, [&](int InFaceIndex, Mat41* OutPositions)
+		{
+			for (int VertexIdx = 0; VertexIdx < 3; VertexIdx++)
+			{
+				const VertexOut& Vertex = Cache.Fetch(InIndices[InFaceIndex * 3 + VertexIdx], ShadeVertex, VertexStats);
+				InShader.SetCorner(VertexIdx, Vertex);
+				OutPositions[VertexIdx] = Vertex.Position;
+			}
+		});
+	}
+
+	// shader without VertexOut, nothing to cache.
+	template <class ShaderType>
+	void DrawIndexed(ShaderType& InShader, Span<int> InIndices, float* InZBuffer, TGAImage& InImage, std::false_type)
+	{
+		DrawModel(InShader, InIndices.size() / 3, InZBuffer, InImage);
+	}
+
+	// a triangle handed to the raster pass. pieces of a clipped face share the shader copy of the face.
+	struct RasterTriangle
+	{
+		Vec3f Screen[3];
+		float InvW[3]; // 1/w of the corners, for perspective correct interpolation
+		int ShaderIndex;
+		bool bClipped;
+		Vec3f CornerWeights[3]; // see Triangle::DrawAndFillTriangleWithShader, only when bClipped
+	};
+
+	// InVertexStage(FaceIndex, Positions) runs vertex shader for the 3 corners of a face, leaving their varyings in InShader.
+	template <class ShaderType, class VertexStageFunc>
+	void DrawTriangles(ShaderType& InShader, int InNumFaces, float* InZBuffer, TGAImage& InImage, VertexStageFunc&& InVertexStage)
+	{
+		const int ImageWidth = InImage.get_width();
+		const int ImageHeight = InImage.get_height();
+		const int TilesX = (ImageWidth + TileSize - 1) / TileSize;
+		const int TilesY = (ImageHeight + TileSize - 1) / TileSize;
+		const Clipper FaceClipper(ImageWidth, ImageHeight);
+
+		// setup pass, vertex shader writes into the shader object, so this runs on one thread.
+		std::vector<ShaderType> TriangleShaders;
+		std::vector<RasterTriangle> Triangles;
+		std::vector<std::vector<int> > TileBins(TilesX*TilesY);
+		TriangleShaders.reserve(InNumFaces);
+		Triangles.reserve(InNumFaces);
+		TriStats.Reset();
+
+		for (int FaceIndex = 0; FaceIndex < InNumFaces; FaceIndex++)
+		{
+			Mat41 Positions[3];
+			InVertexStage(FaceIndex, Positions);
+			VertexStats.Triangles++;
+			TriStats.Submitted++;
+
+			// pieces to draw: the face itself, or the fan of the polygon left after clipping.
+			RasterTriangle Pieces[Clipper::MaxTriangles];
+			int NumPieces = 0;
+			const Clipper::EResult ClipResult = FaceClipper.Classify(Positions);
+			if (ClipResult == Clipper::EResult::Outside)
+			{
+				TriStats.Offscreen++;
+				continue;
+			}
+			if (ClipResult == Clipper::EResult::Inside)
+			{
+				for (int VertexIdx = 0; VertexIdx < 3; VertexIdx++)
+				{
+					Pieces[0].Screen[VertexIdx] = Transform::Matrix2Vec(Positions[VertexIdx]);
+					Pieces[0].InvW[VertexIdx] = 1.f / Positions[VertexIdx][3][0];
+				}
+				Pieces[0].bClipped = false;
+				NumPieces = 1;
+			}
+			else
+			{
+				TriStats.Clipped++;
+				ClipVertex Polygon[Clipper::MaxVertices];
+				const int NumVertices = FaceClipper.Clip(Positions, Polygon);
+				for (int Fan = 1; Fan + 1 < NumVertices; Fan++)
+				{
+					RasterTriangle& Piece = Pieces[NumPieces++];
+					const ClipVertex* Corners[3] = { &Polygon[0], &Polygon[Fan], &Polygon[Fan + 1] };
+					for (int VertexIdx = 0; VertexIdx < 3; VertexIdx++)
+					{
+						Piece.Screen[VertexIdx] = Clipper::ToScreen(*Corners[VertexIdx]);
+						Piece.InvW[VertexIdx] = 1.f / Corners[VertexIdx]->Position[3];
+						Piece.CornerWeights[VertexIdx] = Corners[VertexIdx]->Weights;
+					}
+					Piece.bClipped = true;
+				}
+			}
+
+			// a face is counted binned when any piece is, otherwise by why its pieces were dropped.
+			// clipping keeps the winding, so pieces are culled (or not) all together.
+			bool bBinned = false, bCulled = false, bOffscreen = false;
+			for (int PieceIndex = 0; PieceIndex < NumPieces; PieceIndex++)
+			{
+				RasterTriangle& Piece = Pieces[PieceIndex];
+
+				// same area the rasterizer computes, so whatever passes here is not rejected again per tile.
+				const long long Area = TriangleSetup::SignedArea(Piece.Screen);
+				if (TriangleSetup::IsDegenerate(Area))
+				{
+					continue;
+				}
+				if (TriangleSetup::IsCulled(Area, CullMode))
+				{
+					bCulled = true;
+					break;
+				}
+
+				// same pixel range as the rasterizer loops, skip triangles which cover no pixel at all.
+				int MinX, MinY, MaxX, MaxY;
+				if (!TriangleSetup::PixelBounds(Piece.Screen, ImageWidth, ImageHeight, MinX, MinY, MaxX, MaxY))
+				{
+					bOffscreen = true;
+					continue;
+				}
+
+				if (!bBinned)
+				{
+					InShader.SetupTriangle();
+					TriangleShaders.push_back(InShader);
+					bBinned = true;
+				}
+				Piece.ShaderIndex = (int)TriangleShaders.size() - 1;
+				int TriangleIndex = (int)Triangles.size();
+				Triangles.push_back(Piece);
+
+				for (int TileY = MinY / TileSize; TileY <= MaxY / TileSize; TileY++)
+				{
+					for (int TileX = MinX / TileSize; TileX <= MaxX / TileSize; TileX++)
+					{
+						TileBins[TileY*TilesX + TileX].push_back(TriangleIndex);
+					}
+				}
+			}
+
+			if (bBinned)
+			{
+				TriStats.Binned++;
+			}
+			else if (bCulled)
+			{
+				TriStats.Culled++;
+			}
+			else if (bOffscreen || NumPieces == 0)
+			{
+				TriStats.Offscreen++;
+			}
+			else
+			{
+				TriStats.Degenerate++;
+			}
+		}
+
+		// raster pass, one tile per job.
+		const int BytesPP = InImage.get_bytespp();
+		std::vector<RasterStats> TileStats(TilesX*TilesY);
+		Workers.ParallelFor(TilesX*TilesY, [&](int TileIndex)
+		{
+			const std::vector<int>& Bin = TileBins[TileIndex];
+			if (Bin.empty())
+			{
+				return;
+			}
+
+			float TileZBuffer[TileSize*TileSize];
+			unsigned char TileColor[TileSize*TileSize * 4];
+
+			RasterTarget Target;
+			Target.ZBuffer = TileZBuffer;
+			Target.Color = TileColor;
+			Target.Stride = TileSize;
+			Target.BytesPP = BytesPP;
+			Target.MinX = (TileIndex % TilesX) * TileSize;
+			Target.MinY = (TileIndex / TilesX) * TileSize;
+			Target.MaxX = std::min(Target.MinX + TileSize, ImageWidth);
+			Target.MaxY = std::min(Target.MinY + TileSize, ImageHeight);
+			Target.Stats = &TileStats[TileIndex];
+
+			// load tile from the image.
+			const int RowPixels = Target.MaxX - Target.MinX;
+			for (int Y = Target.MinY; Y < Target.MaxY; Y++)
+			{
+				int TileRow = (Y - Target.MinY)*TileSize;
+				int ImageRow = Y*ImageWidth + Target.MinX;
+				memcpy(TileZBuffer + TileRow, InZBuffer + ImageRow, RowPixels * sizeof(float));
+				memcpy(TileColor + TileRow*BytesPP, InImage.row(Y) + Target.MinX*BytesPP, RowPixels*BytesPP);
+			}
+
+			HiZBuffer TileHiZ;
+			if (bHiZEnabled)
+			{
+				TileHiZ.Build(TileZBuffer, TileSize, RowPixels, Target.MaxY - Target.MinY);
+				Target.HiZ = &TileHiZ;
+			}
+
+			for (int TriangleIndex : Bin)
+			{
+				RasterTriangle& Tri = Triangles[TriangleIndex];
+				Triangle::DrawAndFillTriangleWithShader(Tri.Screen, TriangleShaders[Tri.ShaderIndex], Target, Tri.InvW,
+					Tri.bClipped ? Tri.CornerWeights : nullptr);
+			}
+
+			// store tile back.
+			for (int Y = Target.MinY; Y < Target.MaxY; Y++)
+			{
+				int TileRow = (Y - Target.MinY)*TileSize;
+				int ImageRow = Y*ImageWidth + Target.MinX;
+				memcpy(InZBuffer + ImageRow, TileZBuffer + TileRow, RowPixels * sizeof(float));
+				memcpy(InImage.row(Y) + Target.MinX*BytesPP, TileColor + TileRow*BytesPP, RowPixels*BytesPP);
+			}
+		});
+
+		PixelStats.Reset();
+		for (const RasterStats& Stats : TileStats)
+		{
+			PixelStats += Stats;
+		}
+	}
+
+	ThreadPool Workers;
+	ECullMode CullMode;
+	VertexCacheStats VertexStats;
+	TriangleStats TriStats;
+	RasterStats PixelStats;
+	bool bHiZEnabled;
+};
@@ -1,28 +1,28 @@
 #pragma once
 #include "..\Utils\geometry.h"
 
-static int Depth = 255;
+static const int Depth = 255;
 
 class Transform
 {
 public:
 
 	// 4*1 matrix to vec3f for point
-	static Vec3f Matrix2Vec(Matrix InMatrix)
+	static Vec3f Matrix2Vec(const Mat41& InMatrix)
 	{
 		return Vec3f(InMatrix[0][0] / InMatrix[3][0], InMatrix[1][0] / InMatrix[3][0], InMatrix[2][0] / InMatrix[3][0]);
 	}
 
 	// 4*1 matrix to vec3f for vector
-	static Vec3f Matrix2VecForV(Matrix InMatrix)
+	static Vec3f Matrix2VecForV(const Mat41& InMatrix)
 	{
 		return Vec3f(InMatrix[0][0], InMatrix[1][0], InMatrix[2][0]);
 	}
 
 	// vec3f to 4*1 matrix.
-	static Matrix Vec2Matrix(Vec3f InVec, float InFill = 1.f)
+	static Mat41 Vec2Matrix(Vec3f InVec, float InFill = 1.f)
 	{
-		Matrix Result(4, 1);
+		Mat41 Result;
 		Result[0][0] = InVec.x;
 		Result[1][0] = InVec.y;
 		Result[2][0] = InVec.z;
@@ -31,9 +31,9 @@ public:
 		return Result;
 	}
 
-	static Matrix Vec2Matrix13(Vec3f InVec)
+	static Mat13 Vec2Matrix13(Vec3f InVec)
 	{
-		Matrix Result(1, 3);
+		Mat13 Result;
 		Result[0][0] = InVec.x;
 		Result[0][1] = InVec.y;
 		Result[0][2] = InVec.z;
@@ -42,9 +42,9 @@ public:
 	}
 
 	// Vec3f convert to translation matrix
-	static Matrix Translation(Vec3f InVec)
+	static Mat4 Translation(Vec3f InVec)
 	{
-		Matrix Translation(Matrix::Identity(4));
+		Mat4 Translation(Mat4::Identity());
 		Translation[0][3] = InVec.x;
 		Translation[1][3] = InVec.y;
 		Translation[2][3] = InVec.z;
@@ -53,9 +53,9 @@ public:
 	}
 
 	// Vec3f convert to scale matrix
-	static Matrix Scale(Vec3f InVec)
+	static Mat4 Scale(Vec3f InVec)
 	{
-		Matrix Scale(Matrix::Identity(4));
+		Mat4 Scale(Mat4::Identity());
 		Scale[0][0] = InVec.x;
 		Scale[1][1] = InVec.y;
 		Scale[2][2] = InVec.z;
@@ -64,7 +64,7 @@ public:
 	}
 
 	// Zoom by apply same scaling.
-	static Matrix Zoom(float InFactor)
+	static Mat4 Zoom(float InFactor)
 	{
 		Vec3f ZoomVec(InFactor, InFactor, InFactor);
 		return Scale(ZoomVec);
@@ -72,9 +72,9 @@ public:
 
 	// Vec3f convert to rotation matrix
 	// rotate along x-axis.
-	static Matrix RotationX(float InCosAngle, float InSinAngle)
+	static Mat4 RotationX(float InCosAngle, float InSinAngle)
 	{
-		Matrix Rotation(Matrix::Identity(4));
+		Mat4 Rotation(Mat4::Identity());
 
 		Rotation[1][1] = Rotation[2][2] = InCosAngle;
 		Rotation[1][2] = -InSinAngle;
@@ -84,9 +84,9 @@ public:
 	}
 
 	// rotate along y-axis.
-	static Matrix RotationY(float InCosAngle, float InSinAngle)
+	static Mat4 RotationY(float InCosAngle, float InSinAngle)
 	{
-		Matrix Rotation(Matrix::Identity(4));
+		Mat4 Rotation(Mat4::Identity());
 
 		Rotation[0][0] = Rotation[2][2] = InCosAngle;
 		Rotation[0][2] = -InSinAngle;
@@ -96,9 +96,9 @@ public:
 	}
 
 	// rotate along z-axis.
-	static Matrix RotationZ(float InCosAngle, float InSinAngle)
+	static Mat4 RotationZ(float InCosAngle, float InSinAngle)
 	{
-		Matrix Rotation(Matrix::Identity(4));
+		Mat4 Rotation(Mat4::Identity());
 
 		Rotation[0][0] = Rotation[1][1] = InCosAngle;
 		Rotation[0][1] = -InSinAngle;
@@ -111,9 +111,9 @@ public:
 	// vertex -> [-1,1]
 	// after apply viewport matrix,
 	// [-1,1] is mapping to [X, X+Width] [Y, Y+Height] [0, Depth]
-	static Matrix Viewport(int X, int Y, int Width, int Height)
+	static Mat4 Viewport(int X, int Y, int Width, int Height)
 	{
-		Matrix Result(Matrix::Identity(4));
+		Mat4 Result(Mat4::Identity());
 
 		Result[0][3] = X + Width / 2.f;
 		Result[1][3] = Y + Height / 2.f;
@@ -132,16 +132,16 @@ public:
 	// we know upper vector in world, then we can compute right (x) axis of camera space by cross product
 	// of upper and camera vector.
 	// lastly we compute upper vector(y-axis) of camera space by another cross product of x and z.
-	static Matrix LookAt(Vec3f InEye, Vec3f InCenter, Vec3f InUp)
+	static Mat4 LookAt(Vec3f InEye, Vec3f InCenter, Vec3f InUp)
 	{
-		Matrix Result(Matrix::Identity(4));
+		Mat4 Result(Mat4::Identity());
 		// compute transformed frame x,y,z axis.
 		Vec3f z = (InEye - InCenter).normalize();
 		Vec3f x = cross(InUp, z).normalize();
 		Vec3f y = cross(z, x).normalize();
 
-		Matrix CameraFrame = Matrix::Identity(4);
-		Matrix Translation = Matrix::Identity(4);
+		Mat4 CameraFrame = Mat4::Identity();
+		Mat4 Translation = Mat4::Identity();
 
 		// lookup matrix is camera frame multiply a translation(world to camera translation)
 		for (int i = 0; i < 3; i++)
@@ -157,9 +157,9 @@ public:
 	}
 
 	// construct projection matrix
-	static Matrix Projection(float InCoffient)
+	static Mat4 Projection(float InCoffient)
 	{
-		Matrix Result(Matrix::Identity(4));
+		Mat4 Result(Mat4::Identity());
 		Result[3][2] = InCoffient;
 		return Result;
 	}
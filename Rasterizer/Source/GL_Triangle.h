@@ -2,12 +2,55 @@
 #pragma once
 
 #include <algorithm>
+#include <string.h>
 #include "GL_Line.h"
 #include "GL_Shader.h"
+#include "GL_RasterKernel.h"
+#include "GL_HiZ.h"
+
+// what the pixel loop did, added up over the triangles drawn into a target.
+struct RasterStats
+{
+	long long Blocks = 0; // rows of 8 pixels tested for coverage and depth
+	long long Fragments = 0; // pixels covered and passing depth test, handed to the fragment shader
+	long long HiZCells = 0; // 8x8 cells of a triangle skipped as occluded
+	int HiZTriangles = 0; // triangles skipped as a whole
+
+	void Reset() { *this = RasterStats(); }
+
+	RasterStats& operator+=(const RasterStats& InOther)
+	{
+		Blocks += InOther.Blocks;
+		Fragments += InOther.Fragments;
+		HiZCells += InOther.HiZCells;
+		HiZTriangles += InOther.HiZTriangles;
+		return *this;
+	}
+};
+
+// a rectangular region of a color buffer and its z buffer that triangles are rasterized into.
+// pixel (X, Y) of the screen lives at index Stride*(Y - MinY) + (X - MinX) of both buffers.
+struct RasterTarget
+{
+	float* ZBuffer;
+	unsigned char* Color;
+	int Stride;
+	int BytesPP;
+	int MinX, MinY; // inclusive
+	int MaxX, MaxY; // exclusive
+	// optional: hierarchical z of the region's z buffer (cell 0 starts at MinX, MinY), used and kept up to date.
+	HiZBuffer* HiZ = nullptr;
+	// optional: counters to add to.
+	RasterStats* Stats = nullptr;
+};
 
 class Triangle
 {
 public:
+	// distance in pixels between screen columns where rasterizer re-evaluates edge functions instead of stepping them.
+	// TileRasterizer's tile size is a multiple of it.
+	static const int EdgeAnchorSpacing = 64;
+
 	// draw contour of triangle
 	static void DrawTriangle2D(Vec2i InVert0, Vec2i InVert1, Vec2i InVert2, TGAImage &InImage, TGAColor InColor)
 	{
@@ -409,60 +452,203 @@ public:
 	}
 
 	// refactor DrawAndFillTriangle3D_GouraudShading to do triangle rasterization for arbitary shader. 
-	static void DrawAndFillTriangleWithShader(Vec3f* InScreenVert, IShader& InShader, float* InZBuffer, TGAImage &InImage)
+	// ShaderType is either the concrete shader class, whose fragment shader is then inlined into the pixel loop,
+	// or IShader to go through the virtual interface.
+	// caller runs the shader's Vertex for the 3 vertices and then SetupTriangle before drawing.
+	// without InInvW (1/w of the vertices) varyings are interpolated linearly in screen space, which warps under perspective.
+	template <class ShaderType>
+	static void DrawAndFillTriangleWithShader(Vec3f* InScreenVert, ShaderType& InShader, float* InZBuffer, TGAImage &InImage, const float* InInvW = nullptr)
 	{
-		// find bounding box of triangle by give 3 points.
-		// a bounding box is defined by 2 points: bottom left and upper right of box containing triangle.
-		// to find these corner points, iterate through 3 vertices of the triangle and choose min/max coordinates.
-		Vec2f BBoxMin(0, 0);
-		Vec2f BBoxMax(InImage.get_width(), InImage.get_height());
+		RasterTarget Target;
+		Target.ZBuffer = InZBuffer;
+		Target.Color = InImage.buffer();
+		Target.Stride = InImage.get_width();
+		Target.BytesPP = InImage.get_bytespp();
+		Target.MinX = 0;
+		Target.MinY = 0;
+		Target.MaxX = InImage.get_width();
+		Target.MaxY = InImage.get_height();
+
+		DrawAndFillTriangleWithShader(InScreenVert, InShader, Target, InInvW);
+	}
 
-		// find triangle vertices' min X/Y and max X/Y
-		// also need to consider triangle may out of image box.
-		std::vector<Vec3f> Triangle;
-		for (int index = 0; index < 3; index++)
+	// rasterize triangle into the pixels of InTarget's region only.
+	// every pixel is computed independently from its neighbours, so splitting the screen into several regions
+	// (e.g. tiles of TileRasterizer) gives exactly the same result as drawing into the whole image at once.
+	// the bounding box is walked in cells of 8x8 pixels, one row of a cell being a block of 8 pixels: RasterKernel tests
+	// coverage and depth of a whole block with SIMD, and the live pixels of the block are shaded together by the shader's
+	// batched FragmentBlock. with a HiZBuffer, cells (or the whole triangle) behind what is already drawn are skipped.
+	// coverage uses exact integer edge functions of the vertices snapped to 24.8 fixed point with the top-left rule, so
+	// triangles sharing an edge never leave a crack or draw a pixel twice (see TriangleSetup).
+	// barycentric/depth/1w are evaluated at the start of every span of EdgeAnchorSpacing pixels at fixed
+	// screen columns and stepped from there, which keeps float rounding the same no matter where a region starts.
+	// InInvW is optional 1/w of the vertices for perspective correct barycentric.
+	// InCornerWeights is given when InScreenVert is a piece of a clipped triangle: barycentric coordinates of the piece's
+	// corners in the shader's triangle (see Clipper), fragments then get barycentric coordinates of the shader's triangle.
+	template <class ShaderType>
+	static void DrawAndFillTriangleWithShader(Vec3f* InScreenVert, ShaderType& InShader, const RasterTarget& InTarget, const float* InInvW = nullptr,
+		const Vec3f* InCornerWeights = nullptr)
+	{
+		static_assert(HiZBuffer::CellSize == PixelBlock::Size, "a row of a hi-z cell is one pixel block");
+		static_assert(EdgeAnchorSpacing % HiZBuffer::CellSize == 0, "a hi-z cell never crosses an edge function anchor");
+		const int CellSize = HiZBuffer::CellSize;
+
+		TriangleSetup Setup;
+		if (!Setup.Init(InScreenVert, InInvW))
 		{
-			Triangle.push_back(InScreenVert[index]);
+			return;
 		}
 
-		// find min/max x/y of 3 vertices of this triangle
-		std::sort(Triangle.begin(), Triangle.end(), [](Vec3f a, Vec3f b) {return a.y > b.y; });
-		BBoxMax.y = std::min((float)InImage.get_height(), Triangle[0].y);
-		BBoxMin.y = std::max(0.f, Triangle[2].y);
+		// bounding box of the samples the snapped triangle can cover, within the region.
+		const int XStart = std::max(Setup.MinX, InTarget.MinX);
+		const int XEnd = std::min(Setup.MaxX + 1, InTarget.MaxX);
+		const int YStart = std::max(Setup.MinY, InTarget.MinY);
+		const int YEnd = std::min(Setup.MaxY + 1, InTarget.MaxY);
+		if (XStart >= XEnd || YStart >= YEnd)
+		{
+			return;
+		}
 
-		std::sort(Triangle.begin(), Triangle.end(), [](Vec3f a, Vec3f b) {return a.x > b.x; });
-		BBoxMax.x = std::min((float)InImage.get_width(), Triangle[0].x);
-		BBoxMin.x = std::max(0.f, Triangle[2].x);
+		// cells of the region touched by the bounding box.
+		const int CellXBegin = (XStart - InTarget.MinX) / CellSize, CellXEnd = (XEnd - 1 - InTarget.MinX) / CellSize + 1;
+		const int CellYBegin = (YStart - InTarget.MinY) / CellSize, CellYEnd = (YEnd - 1 - InTarget.MinY) / CellSize + 1;
 
-		// for each pixel in this bounding box, test point if it is inside triangle, if yes draw pixel.
-		for (int X = BBoxMin.x; X < BBoxMax.x; X++)
+		// no pixel of the triangle is nearer than its nearest vertex. tolerance covers rounding of the stepped depth,
+		// which grows with the size of the terms it is computed from.
+		const float TriangleMaxZ = std::max(InScreenVert[0].z, std::max(InScreenVert[1].z, InScreenVert[2].z));
+		const float DepthTolerance = 1e-4f*(1.f + std::abs(TriangleMaxZ) + std::abs(Setup.DZDX)*(XEnd - XStart + CellSize) +
+			std::abs(Setup.DZDY)*(YEnd - YStart + CellSize));
+
+		if (InTarget.HiZ)
 		{
-			for (int Y = BBoxMin.y; Y < BBoxMax.y; Y++)
+			bool bVisible = false;
+			for (int CellY = CellYBegin; CellY < CellYEnd && !bVisible; CellY++)
 			{
-				Vec3f CurrentPoint(X, Y, 0);
-				Vec3f BarycentricVec = ComputeBarycentric3D(InScreenVert, CurrentPoint);
-				int CurrentPointZBufferIndex = InImage.get_width()*Y + X;
+				for (int CellX = CellXBegin; CellX < CellXEnd && !bVisible; CellX++)
+				{
+					bVisible = !InTarget.HiZ->IsOccluded(CellX, CellY, TriangleMaxZ, DepthTolerance, InTarget.ZBuffer, InTarget.Stride);
+				}
+			}
+			if (!bVisible)
+			{
+				if (InTarget.Stats)
+				{
+					InTarget.Stats->HiZTriangles++;
+				}
+				return;
+			}
+		}
 
-				// interpolate pixel z buffer
-				CurrentPoint.z = InScreenVert[0].z*BarycentricVec.x +
-					InScreenVert[1].z*BarycentricVec.y +
-					InScreenVert[2].z*BarycentricVec.z;
+		PixelBlock Block;
+		BarycentricBlock Fragments;
+		TGAColor PixelColors[PixelBlock::Size];
+		long long NumBlocks = 0, NumFragments = 0, NumHiZCells = 0;
+		for (int CellY = CellYBegin; CellY < CellYEnd; CellY++)
+		{
+			const int Y0 = std::max(YStart, InTarget.MinY + CellY*CellSize);
+			const int Y1 = std::min(YEnd, InTarget.MinY + (CellY + 1)*CellSize);
+			for (int CellX = CellXBegin; CellX < CellXEnd; CellX++)
+			{
+				const int X0 = std::max(XStart, InTarget.MinX + CellX*CellSize);
+				const int X1 = std::min(XEnd, InTarget.MinX + (CellX + 1)*CellSize);
 
-				if (BarycentricVec.x < 0 || BarycentricVec.y < 0 || BarycentricVec.z < 0
-					|| InZBuffer[CurrentPointZBufferIndex] > CurrentPoint.z)
+				if (InTarget.HiZ)
 				{
-					continue;
+					// depth plane is largest at one of the corners of the cell's pixels.
+					float CellMaxZ = Setup.Z0 + Setup.DZDX*(X0 - Setup.X0) + Setup.DZDY*(Y0 - Setup.Y0) +
+						std::max(0.f, Setup.DZDX*(X1 - 1 - X0)) + std::max(0.f, Setup.DZDY*(Y1 - 1 - Y0));
+					if (InTarget.HiZ->IsOccluded(CellX, CellY, std::min(CellMaxZ, TriangleMaxZ), DepthTolerance, InTarget.ZBuffer, InTarget.Stride))
+					{
+						NumHiZCells++;
+						continue;
+					}
 				}
 
-				TGAColor PixelColor;
-				bool bDiscard = InShader.Fragment(BarycentricVec, PixelColor);
-				if (!bDiscard)
+				// the cell's blocks lie in one span, starting at an anchor or at the bounding box.
+				const int SpanStart = std::max(XStart, X0 / EdgeAnchorSpacing * EdgeAnchorSpacing);
+				const int K = X0 - SpanStart;
+				const int Count = X1 - X0;
+				NumBlocks += Y1 - Y0;
+				unsigned CellWritten = 0;
+				bool bFarthestOverwritten = false;
+				float NearestWritten = -std::numeric_limits<float>::max();
+				for (int Y = Y0; Y < Y1; Y++)
 				{
-					InZBuffer[CurrentPointZBufferIndex] = CurrentPoint.z;
-					InImage.set(X, Y, PixelColor);
+					const int BlockIndex = InTarget.Stride*(Y - InTarget.MinY) + X0 - InTarget.MinX;
+					long long SpanE[3];
+					float SpanZ, SpanInvW;
+					Setup.EvaluateAt(SpanStart, Y, SpanE, SpanZ, SpanInvW);
+					unsigned Live = RasterKernel::TestBlock(Setup, SpanE, SpanZ, SpanInvW, K, Count, InTarget.ZBuffer + BlockIndex, Block);
+					if (!Live)
+					{
+						continue;
+					}
+
+					RasterKernel::ComputeBarycentric(Setup, Block, Live, Fragments);
+					if (InCornerWeights)
+					{
+						RasterKernel::RemapBarycentric(InCornerWeights, Fragments);
+					}
+					unsigned Written = Live & ~InShader.FragmentBlock(Fragments, PixelColors);
+					NumFragments += RasterKernel::CountLanes(Live);
+					if (InTarget.HiZ)
+					{
+						for (unsigned Lanes = Written; Lanes; Lanes &= Lanes - 1)
+						{
+							const int Lane = RasterKernel::LowestLane(Lanes);
+							bFarthestOverwritten |= InTarget.ZBuffer[BlockIndex + Lane] == InTarget.HiZ->MinZ(CellX, CellY);
+							NearestWritten = std::max(NearestWritten, Block.Z[Lane]);
+						}
+					}
+
+					if (Written)
+					{
+						StoreColors(Written, PixelColors, InTarget.Color + BlockIndex*InTarget.BytesPP, InTarget.BytesPP);
+						RasterKernel::StoreDepth(Written, Block.Z, InTarget.ZBuffer + BlockIndex);
+						CellWritten |= Written;
+					}
+				}
+
+				if (InTarget.HiZ && CellWritten)
+				{
+					InTarget.HiZ->OnWrite(CellX, CellY, NearestWritten, bFarthestOverwritten);
 				}
 			}
 		}
+
+		if (InTarget.Stats)
+		{
+			InTarget.Stats->Blocks += NumBlocks;
+			InTarget.Stats->Fragments += NumFragments;
+			InTarget.Stats->HiZCells += NumHiZCells;
+		}
 	}
-};
 
+	// write colors of the lanes in InMask to the color buffer row starting at lane 0.
+	// format is picked once per block, lanes are then stored as typed pixels, no size dependent copy per pixel.
+	static inline void StoreColors(unsigned InMask, const TGAColor* InColors, unsigned char* OutRow, int InBytesPP)
+	{
+		switch (InBytesPP)
+		{
+		case RGB8::bytespp:
+			StoreColors(InMask, InColors, reinterpret_cast<RGB8*>(OutRow));
+			break;
+		case RGBA8::bytespp:
+			StoreColors(InMask, InColors, reinterpret_cast<RGBA8*>(OutRow));
+			break;
+		case Gray8::bytespp:
+			StoreColors(InMask, InColors, reinterpret_cast<Gray8*>(OutRow));
+			break;
+		}
+	}
+
+	template <class PixelType>
+	static inline void StoreColors(unsigned InMask, const TGAColor* InColors, PixelType* OutRow)
+	{
+		for (unsigned Lanes = InMask; Lanes; Lanes &= Lanes - 1)
+		{
+			const int Lane = RasterKernel::LowestLane(Lanes);
+			OutRow[Lane] = PixelType(InColors[Lane]);
+		}
+	}
+};
\ No newline at end of file
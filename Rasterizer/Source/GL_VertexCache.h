@@ -0,0 +1,97 @@
+#pragma once
+
+#include <algorithm>
+#include <type_traits>
+#include <vector>
+
+// Counters of the vertex shader invocations of a draw.
+struct VertexCacheStats
+{
+	long long Triangles = 0;
+	long long Lookups = 0; // one per triangle corner
+	long long Hits = 0; // corners whose vertex was still in the cache
+	long long ShadedVertices = 0; // vertex shader invocations
+
+	void Reset() { *this = VertexCacheStats(); }
+
+	float HitRate() const { return Lookups ? (float)Hits / Lookups : 0.f; }
+	// average cache miss ratio, vertex shader invocations per triangle. 3 without cache, 0.5 at best for a closed mesh.
+	float ACMR() const { return Triangles ? (float)ShadedVertices / Triangles : 0.f; }
+
+	VertexCacheStats& operator+=(const VertexCacheStats& InOther)
+	{
+		Triangles += InOther.Triangles;
+		Lookups += InOther.Lookups;
+		Hits += InOther.Hits;
+		ShadedVertices += InOther.ShadedVertices;
+		return *this;
+	}
+};
+
+// Post-transform vertex cache: keeps vertex shader outputs keyed on vertex index, so a vertex shared by several
+// triangles is shaded once as long as it is not evicted in between.
+// direct mapped, vertex i lives in slot i % slots: a mesh with at most MaxSize vertices shades every vertex exactly once,
+// bigger meshes still hit well when triangles using nearby vertex indices are drawn close together (see vertex fetch order).
+// slots are sized to the vertices a draw can reference, so a small draw doesn't set up MaxSize entries.
+template <class VertexType, int MaxSize = 4096>
+class VertexCache
+{
+	static_assert((MaxSize & (MaxSize - 1)) == 0, "cache size must be a power of two");
+
+public:
+	// vertex indices fetched are below InNumVertices.
+	explicit VertexCache(int InNumVertices = MaxSize) : Mask(SlotCount(InNumVertices) - 1), Keys(Mask + 1, -1), Entries(Mask + 1) {}
+
+	int NumSlots() const { return Mask + 1; }
+
+	void Clear()
+	{
+		std::fill(Keys.begin(), Keys.end(), -1);
+	}
+
+	// return cached output of vertex InIndex, or call InShade(InIndex, Output) to compute it on a miss.
+	template <class ShadeFunc>
+	const VertexType& Fetch(int InIndex, ShadeFunc&& InShade, VertexCacheStats& InOutStats)
+	{
+		InOutStats.Lookups++;
+		const int Slot = InIndex & Mask;
+		if (Keys[Slot] == InIndex)
+		{
+			InOutStats.Hits++;
+		}
+		else
+		{
+			InOutStats.ShadedVertices++;
+			Keys[Slot] = InIndex;
+			InShade(InIndex, Entries[Slot]);
+		}
+		return Entries[Slot];
+	}
+
+private:
+	// smallest power of two >= InNumVertices, at most MaxSize.
+	static int SlotCount(int InNumVertices)
+	{
+		int Count = 1;
+		while (Count < InNumVertices && Count < MaxSize)
+		{
+			Count *= 2;
+		}
+		return Count;
+	}
+
+	int Mask;
+	std::vector<int> Keys;
+	std::vector<VertexType> Entries;
+};
+
+// a shader supports the indexed (cached) draw path when it declares
+//   struct VertexOut { Mat41 Position; ...varyings of one vertex... };
+//   void ShadeVertex(int InVertexIndex, VertexOut& OutVertex);            // vertex shader of one model vertex
+//   void SetCorner(int InCorner, const VertexOut& InVertex);              // load varyings of triangle corner 0..2
+// other shaders are drawn through Vertex(FaceIndex, Corner) for every corner.
+template <class ShaderType, class = void>
+struct HasVertexOut : std::false_type {};
+
+template <class ShaderType>
+struct HasVertexOut<ShaderType, decltype(void(sizeof(typename ShaderType::VertexOut)))> : std::true_type {};
@@ -1,15 +1,29 @@
 #include "../Utils/tgaimage.h"
 #include "../Utils/model.h"
 #include "../Utils/geometry.h"
+#include "../Utils/objparser.h"
+#include "../Utils/meshcache.h"
+#include "../Utils/meshopt.h"
 
 #define _USE_MATH_DEFINES // need to define to use M_PI.
 #include <math.h>
-
-#include "GL_Global.h"
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "GL_RenderContext.h"
 #include "GL_Line.h"
 #include "GL_Triangle.h"
 #include "GL_Transform.h"
 #include "GL_Shader.h"
+#include "GL_TileRasterizer.h"
+#include "GL_Framebuffer.h"
+#include "GL_FrameWriter.h"
 
 const TGAColor white = TGAColor(255, 255, 255, 255);
 const TGAColor red = TGAColor(255, 0, 0, 255);
@@ -18,6 +32,17 @@ const TGAColor blue = TGAColor(0, 0, 255, 255);
 
 namespace
 {
+	// scene of the tests, renders copy it into their own RenderContext.
+	const int Width = 800;
+	const int Height = 800;
+
+	const Vec3f Camera(0, 0, 3);
+	const Vec3f Eye(1, 1, 4);
+	const Vec3f Center(0, 0, 0);
+
+	//const Vec3f LightDir = Vec3f(0, 0, -1);
+	const Vec3f LightDir = Vec3f(1, 0, 0);
+
 	//*************************************************************************
 	// Line/Triangle/Model Draw Test
 	//*************************************************************************
@@ -42,7 +67,7 @@ namespace
 		Model ModelData("C:\\Project\\GitRepos\\GraphicsStudy\\Rasterizer\\Resource\\african_head.obj");
 		for (int FaceIndex = 0; FaceIndex < ModelData.nfaces(); FaceIndex++)
 		{
-			std::vector<int> FaceData = ModelData.face(FaceIndex);
+			Span<int> FaceData = ModelData.face(FaceIndex);
 			// face data should contain 3 vertex
 			// draw 3 lines of each face.
 			for (int index = 0; index < 3; index++)
@@ -93,7 +118,7 @@ namespace
 		Vec3f LightDir(0, 0, -1);
 		for (int FaceIndex = 0; FaceIndex < ModelData.nfaces(); FaceIndex++)
 		{
-			std::vector<int> FaceData = ModelData.face(FaceIndex);
+			Span<int> FaceData = ModelData.face(FaceIndex);
 			// face data should contain 3 vertex
 			// draw 3 lines of each face.
 			Vec3f Triangle[3];
@@ -195,7 +220,7 @@ namespace
 		Vec3f YAxis(0.f, 1.f, 0.f);
 		Vec3f Origin(0.f, 0.f, 0.f);
 
-		Matrix VPMatrix(Transform::Viewport(Width / 4, Height / 4, Width / 2, Height / 2));
+		Mat4 VPMatrix(Transform::Viewport(Width / 4, Height / 4, Width / 2, Height / 2));
 		XAxis = Transform::Matrix2Vec(VPMatrix*Transform::Vec2Matrix(XAxis));
 		YAxis = Transform::Matrix2Vec(VPMatrix*Transform::Vec2Matrix(YAxis));
 		Origin = Transform::Matrix2Vec(VPMatrix*Transform::Vec2Matrix(Origin));
@@ -217,13 +242,13 @@ namespace
 
 		// square applied with basic transform
 		// Important: Transform needs to be applied after VPMatrix
-		Matrix Transform1(Transform::Translation(Vec3f(1, 0, 0)));
-		Matrix Transform2(Transform::Scale(Vec3f(2, 2, 2)));
-		Matrix Transform3(Transform::RotationZ(cos(M_PI / 180.f * 30), sin(M_PI / 180.f * 30)));
+		Mat4 Transform1(Transform::Translation(Vec3f(1, 0, 0)));
+		Mat4 Transform2(Transform::Scale(Vec3f(2, 2, 2)));
+		Mat4 Transform3(Transform::RotationZ(cos(M_PI / 180.f * 30), sin(M_PI / 180.f * 30)));
 
 		// notice order of same transforms matters.
 		// first translate then rotate is different from first rotate then translate!
-		Matrix Transform = Transform3*Transform1;
+		Mat4 Transform = Transform3*Transform1;
 
 		V1 = Transform::Matrix2Vec(VPMatrix*Transform*Transform::Vec2Matrix(V1));
 		V2 = Transform::Matrix2Vec(VPMatrix*Transform*Transform::Vec2Matrix(V2));
@@ -249,10 +274,10 @@ namespace
 			ZBuffer[Index] = -std::numeric_limits<float>::max();
 		}
 
-		Matrix ModelView = Transform::LookAt(Eye, Center, Vec3f(0, 1, 0));
-		Matrix VPMatrix(Transform::Viewport(Width / 4, Height / 4, Width / 2, Height / 2));
+		Mat4 ModelView = Transform::LookAt(Eye, Center, Vec3f(0, 1, 0));
+		Mat4 VPMatrix(Transform::Viewport(Width / 4, Height / 4, Width / 2, Height / 2));
 		// construct projection matrix
-		Matrix Projection(Matrix::Identity(4));
+		Mat4 Projection(Mat4::Identity());
 		// perspective projection or make it orthogonal projection with identity
 		//Projection[3][2] = -1. / Camera.z;
 		Projection[3][2] = -1. / (Eye - Center).norm();
@@ -260,7 +285,7 @@ namespace
 		Vec3f LightDir(0, 0, -1);
 		for (int FaceIndex = 0; FaceIndex < ModelData.nfaces(); FaceIndex++)
 		{
-			std::vector<int> FaceData = ModelData.face(FaceIndex);
+			Span<int> FaceData = ModelData.face(FaceIndex);
 			// face data should contain 3 vertex
 			// draw 3 lines of each face.
 			Vec3f TriangleScreen[3];
@@ -318,10 +343,10 @@ namespace
 			ZBuffer[Index] = -std::numeric_limits<float>::max();
 		}
 
-		Matrix ModelView = Transform::LookAt(Eye, Center, Vec3f(0, 1, 0));
-		Matrix VPMatrix(Transform::Viewport(Width / 4, Height / 4, Width / 2, Height / 2));
+		Mat4 ModelView = Transform::LookAt(Eye, Center, Vec3f(0, 1, 0));
+		Mat4 VPMatrix(Transform::Viewport(Width / 4, Height / 4, Width / 2, Height / 2));
 		// construct projection matrix
-		Matrix Projection(Transform::Projection(-1. / (Eye - Center).norm()));
+		Mat4 Projection(Transform::Projection(-1. / (Eye - Center).norm()));
 
 		// how to decide light direction?
 		// note light direction has nothing to do with the camera, it is set by user wish.
@@ -333,7 +358,7 @@ namespace
 		// for each triangle in this model
 		for (int FaceIndex = 0; FaceIndex < ModelData.nfaces(); FaceIndex++)
 		{
-			std::vector<int> FaceData = ModelData.face(FaceIndex);
+			Span<int> FaceData = ModelData.face(FaceIndex);
 			Vec3f TriangleScreen[3];
 			Vec3f TriangleWorld[3];
 			Vec2f UV[3];
@@ -366,149 +391,1217 @@ namespace
 		delete[] ZBuffer;
 	}
 
-	void DrawModelByShader(TGAImage& InImage)
+	// set up context to render model into InImage with the test scene's camera and light.
+	void InitRenderContext(RenderContext& OutContext, Model* InModel, TGAImage& InImage)
+	{
+		OutContext.ModelData = InModel;
+		OutContext.Width = InImage.get_width();
+		OutContext.Height = InImage.get_height();
+		OutContext.Eye = Eye;
+		OutContext.Center = Center;
+		OutContext.LightDir = LightDir;
+		OutContext.LightDir.normalize();
+	}
+
+	void PrintTriangleStats(const char* InPassName, const TriangleStats& InStats)
+	{
+		std::cerr << InPassName << ": " << InStats.Submitted << " triangles, " << InStats.Culled << " culled, "
+			<< InStats.Degenerate << " degenerate, " << InStats.Offscreen << " offscreen, " << InStats.Binned << " rasterized, "
+			<< InStats.Clipped << " clipped" << std::endl;
+	}
+
+	void DrawModelByShader(Framebuffer& InFrame)
 	{
 		// parse model file .obj using utils class Model.
-		ModelData = new Model("C:\\Project\\GitRepos\\GraphicsStudy\\Rasterizer\\Resource\\african_head.obj");
-		//ModelData = new Model("F:\\workdir\\personal\\Rasterizer\\Resource\\diablo3_pose.obj");
-		int InWidth = InImage.get_width();
-		int InHeight = InImage.get_height();
+		Model ModelData("C:\\Project\\GitRepos\\GraphicsStudy\\Rasterizer\\Resource\\african_head.obj");
+		//Model ModelData("F:\\workdir\\personal\\Rasterizer\\Resource\\diablo3_pose.obj");
+		TGAImage& Image = InFrame.Color();
+		int InWidth = Image.get_width();
+		int InHeight = Image.get_height();
+
+		RenderContext Context;
+		InitRenderContext(Context, &ModelData, Image);
+		Context.ModelView = Transform::LookAt(Context.Eye, Context.Center, Vec3f(0, 1, 0));
+		Context.VPMatrix = Transform::Viewport(InWidth / 4, InHeight / 4, InWidth / 2, InHeight / 2);
+		Context.Projection = Transform::Projection(-1. / (Context.Eye - Context.Center).norm());
+		Context.UpdateUniforms();
+
+		//FlatShader Shader(Context);
+		//GouraudShader Shader(Context);
+		//ToonShader Shader(Context);
+		//GouraudShader_Diffuse Shader(Context);
+		//GouraudShader_NormalMapping Shader(Context);
+		PhongShader Shader(Context);
+
+		// for each triangle in this model call each vertex's vertex shader, then do the rasterization.
+		// same result as calling Triangle::DrawAndFillTriangleWithShader face by face, but tiles are rasterized in parallel,
+		// and vertices shared by neighbouring triangles are shaded once.
+		// the head is closed where it is seen from, so dropping back faces at setup changes no pixel.
+		TileRasterizer Rasterizer;
+		Rasterizer.SetCullMode(ECullMode::Back);
+		InFrame.Clear();
+		Rasterizer.DrawIndexed(Shader, ModelData.indices(), InFrame.Depth(), Image);
+		PrintTriangleStats("draw", Rasterizer.GetTriangleStats());
+	}
 
-		float* ZBuffer = new float[InWidth*InHeight];
-		for (int Index = 0; Index < InWidth*InHeight; Index++)
+	// render InModel seen from InEye with shadows into InFrame (which needs the shadow attachments), after clearing it.
+	// first pass draws the depth of the model seen from the light into the shadow buffer, second pass draws the frame
+	// and looks up every fragment in the shadow buffer.
+	// triangle counters of the two passes go to OutShadowStats/OutFrameStats when given.
+	void DrawShadowedFrame(Framebuffer& InFrame, Model& InModel, const Vec3f& InEye, TileRasterizer& InRasterizer,
+		TriangleStats* OutShadowStats = nullptr, TriangleStats* OutFrameStats = nullptr)
+	{
+		TGAImage& Image = InFrame.Color();
+		int InWidth = Image.get_width();
+		int InHeight = Image.get_height();
+		InFrame.Clear();
+
+		RenderContext Context;
+		InitRenderContext(Context, &InModel, Image);
+		Context.Eye = InEye;
+		// now first look at light direction
+		Context.ModelView = Transform::LookAt(Context.LightDir, Context.Center, Vec3f(0, 1, 0));
+		Context.VPMatrix = Transform::Viewport(InWidth / 4, InHeight / 4, InWidth / 2, InHeight / 2);
+		//Context.Projection = Transform::Projection(-1. / (Context.Eye - Context.Center).norm());
+		// why???
+		Context.Projection = Transform::Projection(0);
+		Context.UpdateUniforms();
+
+		// keep the object to screen transform of first pass.
+		Mat4 ObjToScreenM = Context.VPMatrix*Context.Projection*Context.ModelView;
+
+		// first pass is compute depth shader, to get the info which part was lit, which part was hidden.
+		// so the shadow buffer is z-buffer from light direction.
+		DepthShader FirstPassShader(Context);
+
+		InRasterizer.DrawIndexed(FirstPassShader, InModel.indices(), InFrame.ShadowDepth(), InFrame.ShadowColor());
+		if (OutShadowStats)
 		{
-			ZBuffer[Index] = -std::numeric_limits<float>::max();
+			*OutShadowStats = InRasterizer.GetTriangleStats();
 		}
 
-		ModelView = Transform::LookAt(Eye, Center, Vec3f(0, 1, 0));
-		VPMatrix = Transform::Viewport(Width / 4, Height / 4, Width / 2, Height / 2);
-		Projection = Transform::Projection(-1. / (Eye - Center).norm());
-		LightDir.normalize();
+		// second pass shader
+		Mat4 FrameModelView = Transform::LookAt(Context.Eye, Context.Center, Vec3f(0, 1, 0));
+		Mat4 FrameVPMatrix = Transform::Viewport(InWidth / 4, InHeight / 4, InWidth / 2, InHeight / 2);
+		Mat4 FrameProjection = Transform::Projection(-1. / (Context.Eye - Context.Center).norm());
 
-		Uniform_M = Projection*ModelView;
-		Uniform_MIT = Uniform_M.Transpose().Inverse();
+		Mat4 Uniform_Frame_M = FrameProjection*FrameModelView;
+		Mat4 Uniform_Frame_MIT = Uniform_Frame_M.Transpose().Inverse();
 
-		//FlatShader Shader;
-		//GouraudShader Shader;
-		//ToonShader Shader;
-		//GouraudShader_Diffuse Shader;
-		//GouraudShader_NormalMapping Shader;
-		PhongShader Shader;
+		// same model vertex in model space, with different transform, we have different frame buffers.
+		// so Transform*vt = VinW; vt = (Transform)^-1*VinW
+		// (T1)^-1*V1 = (T2)^-1*V2, for space 1 and 2.
+		// assume transform from 1 to 2 is M12, then V2 = M12*V1;
+		// so M12 = T2*(T1)^-1.
+		// now we want to solve Frame buffer in Shadow buffer, means Uniform_FrameToShadow_M = Tshadow*(Tframe)^-1.
+		// we have local to screen transform Tshadow, which is ObjToScreenM.
+		// and also Tframe = VPMatrix*Uniform_M
+		Mat4 Uniform_FrameToShadow_M = ObjToScreenM*(FrameVPMatrix*Uniform_Frame_M).Inverse();
 
-		// for each triangle in this model
-		for (int FaceIndex = 0; FaceIndex < ModelData->nfaces(); FaceIndex++)
+		ShadowShader SecondPassShader(Context, Uniform_Frame_M, Uniform_Frame_MIT, Uniform_FrameToShadow_M, InFrame.ShadowDepth());
+
+		InRasterizer.DrawIndexed(SecondPassShader, InModel.indices(), InFrame.Depth(), Image);
+		if (OutFrameStats)
 		{
-			std::vector<int> FaceData = ModelData->face(FaceIndex);
-			Vec3f TriangleScreen[3];
+			*OutFrameStats = InRasterizer.GetTriangleStats();
+		}
+	}
 
-			// call each vertex's vertex shader.
-			for (int VertexIdx = 0; VertexIdx < 3; VertexIdx++)
+	void DrawModelWithShadow(Framebuffer& InFrame)
+	{
+		// parse model file .obj using utils class Model.
+		Model ModelData("C:\\Project\\GitRepos\\GraphicsStudy\\Rasterizer\\Resource\\diablo3_pose.obj");
+
+		// both passes share the worker threads.
+		TileRasterizer Rasterizer;
+		Rasterizer.SetCullMode(ECullMode::Back);
+		TriangleStats ShadowStats, FrameStats;
+		DrawShadowedFrame(InFrame, ModelData, Eye, Rasterizer, &ShadowStats, &FrameStats);
+		PrintTriangleStats("shadow pass", ShadowStats);
+		PrintTriangleStats("frame pass", FrameStats);
+	}
+
+	// camera circles the model in InNumFrames steps, every frame is drawn with shadows into the same framebuffer
+	// and written to output_turntable_<frame>.tga by a FrameWriter with InWriteThreads threads (0 writes every frame
+	// before drawing the next). prints time per frame, split into clear, draw and submit, and the wait for the last frames.
+	void TurntableTest(int InNumFrames = 120, int InWriteThreads = 2)
+	{
+		Model ModelData("C:\\Project\\GitRepos\\GraphicsStudy\\Rasterizer\\Resource\\diablo3_pose.obj");
+
+		typedef std::chrono::high_resolution_clock Clock;
+		TileRasterizer Rasterizer;
+		Rasterizer.SetCullMode(ECullMode::Back);
+		Framebuffer Frame(Width, Height, TGAImage::RGB, true);
+		FrameWriter Writer("output_turntable_", EFrameFormat::TgaRle, InWriteThreads + 1, InWriteThreads);
+
+		Clock::time_point Start = Clock::now();
+		const float Radius = std::sqrt(Eye.x*Eye.x + Eye.z*Eye.z);
+		double ClearTime = 0, DrawTime = 0, WriteTime = 0;
+		for (int FrameIndex = 0; FrameIndex < InNumFrames; FrameIndex++)
+		{
+			float Angle = 2.f*(float)M_PI*FrameIndex / InNumFrames;
+			Vec3f FrameEye(Radius*std::sin(Angle), Eye.y, Radius*std::cos(Angle));
+
+			// DrawShadowedFrame clears too, clearing once more here only to time it.
+			Clock::time_point ClearStart = Clock::now();
+			Frame.Clear();
+			Clock::time_point DrawStart = Clock::now();
+			DrawShadowedFrame(Frame, ModelData, FrameEye, Rasterizer);
+			Clock::time_point WriteStart = Clock::now();
+			Writer.Submit(Frame.Color());
+			Clock::time_point End = Clock::now();
+
+			ClearTime += std::chrono::duration<double, std::milli>(DrawStart - ClearStart).count();
+			DrawTime += std::chrono::duration<double, std::milli>(WriteStart - DrawStart).count();
+			WriteTime += std::chrono::duration<double, std::milli>(End - WriteStart).count();
+		}
+
+		Clock::time_point FlushStart = Clock::now();
+		Writer.Flush();
+		Clock::time_point End = Clock::now();
+
+		std::cout << InNumFrames << " frames, per frame: clear " << ClearTime / InNumFrames << " ms, draw " << DrawTime / InNumFrames
+			<< " ms, submit " << WriteTime / InNumFrames << " ms, " << AttachmentPool::Get().FreeBytes() << " bytes free in pool" << std::endl;
+		std::cout << InWriteThreads << " write threads: flush " << std::chrono::duration<double, std::milli>(End - FlushStart).count()
+			<< " ms, total " << std::chrono::duration<double, std::milli>(End - Start).count() << " ms, "
+			<< Writer.NumFailedFrames() << " frames failed" << std::endl;
+	}
+
+	// independent renders run at the same time, each with its own context, rasterizer and buffers.
+	// every job renders the model with a different light direction to output_<job>.tga.
+	void ConcurrentRenderTest()
+	{
+		Model ModelData("C:\\Project\\GitRepos\\GraphicsStudy\\Rasterizer\\Resource\\african_head.obj");
+
+		const int NumJobs = 4;
+		ThreadPool Jobs(NumJobs);
+		Jobs.ParallelFor(NumJobs, [&](int JobIndex)
+		{
+			Framebuffer Frame(Width, Height);
+			TGAImage& Image = Frame.Color();
+
+			RenderContext Context;
+			InitRenderContext(Context, &ModelData, Image);
+			float Angle = 2.f*(float)M_PI*JobIndex / NumJobs;
+			Context.LightDir = Vec3f(std::cos(Angle), 0.f, std::sin(Angle));
+			Context.ModelView = Transform::LookAt(Context.Eye, Context.Center, Vec3f(0, 1, 0));
+			Context.VPMatrix = Transform::Viewport(Width / 4, Height / 4, Width / 2, Height / 2);
+			Context.Projection = Transform::Projection(-1. / (Context.Eye - Context.Center).norm());
+			Context.UpdateUniforms();
+
+			GouraudShader_Diffuse Shader(Context);
+			TileRasterizer Rasterizer(1);
+			Rasterizer.DrawModel(Shader, ModelData.nfaces(), Frame.Depth(), Image);
+
+			Image.flip_vertically();
+			std::string FileName = "output_" + std::to_string(JobIndex) + ".tga";
+			Image.write_tga_file(FileName.c_str());
+		});
+	}
+
+	// camera flies straight at the head and into it, near plane cuts the model open in the last frames.
+	// projection keeps the eye at w = 0 as usual, so field of view widens as the eye gets closer.
+	// every frame is written to output_clip_<frame>.tga, time and clipping counters are printed per frame.
+	void ClippingTest()
+	{
+		Model ModelData("C:\\Project\\GitRepos\\GraphicsStudy\\Rasterizer\\Resource\\african_head.obj");
+
+		typedef std::chrono::high_resolution_clock Clock;
+		TileRasterizer Rasterizer;
+		Rasterizer.SetCullMode(ECullMode::Back);
+		Framebuffer FrameBuffer(Width, Height);
+		TGAImage& Image = FrameBuffer.Color();
+		const int NumFrames = 8;
+		for (int Frame = 0; Frame < NumFrames; Frame++)
+		{
+			FrameBuffer.Clear();
+
+			RenderContext Context;
+			InitRenderContext(Context, &ModelData, Image);
+			Context.Eye = Vec3f(0.2f, 0.1f, 4.f)*(1.f - (float)Frame / NumFrames);
+			Context.ModelView = Transform::LookAt(Context.Eye, Context.Center, Vec3f(0, 1, 0));
+			Context.VPMatrix = Transform::Viewport(0, 0, Width, Height);
+			Context.Projection = Transform::Projection(-1. / (Context.Eye - Context.Center).norm());
+			Context.UpdateUniforms();
+
+			PhongShader Shader(Context);
+			Clock::time_point Start = Clock::now();
+			Rasterizer.DrawIndexed(Shader, ModelData.indices(), FrameBuffer.Depth(), Image);
+			Clock::time_point End = Clock::now();
+
+			const TriangleStats& Stats = Rasterizer.GetTriangleStats();
+			std::cout << "eye z " << Context.Eye.z << ": " << std::chrono::duration<double, std::milli>(End - Start).count() << " ms, "
+				<< Stats.Clipped << " clipped, " << Stats.Offscreen << " offscreen, " << Stats.Culled << " culled, "
+				<< Stats.Binned << " rasterized" << std::endl;
+
+			Image.flip_vertically();
+			std::string FileName = "output_clip_" + std::to_string(Frame) + ".tga";
+			Image.write_tga_file(FileName.c_str());
+		}
+	}
+
+	// head seen from close by under strong perspective, drawn face by face once with screen space (affine) barycentric
+	// and once perspective correct, to output_affine.tga and output_perspective.tga. prints how many pixels differ.
+	void PerspectiveTest()
+	{
+		Model ModelData("C:\\Project\\GitRepos\\GraphicsStudy\\Rasterizer\\Resource\\african_head.obj");
+
+		const char* FileNames[] = { "output_affine.tga", "output_perspective.tga" };
+		TGAImage Images[2];
+		for (int bPerspective = 0; bPerspective < 2; bPerspective++)
+		{
+			Framebuffer Frame(Width, Height);
+			TGAImage& Image = Frame.Color();
+
+			RenderContext Context;
+			InitRenderContext(Context, &ModelData, Image);
+			Context.Eye = Vec3f(0.5f, 0.5f, 2.f);
+			Context.ModelView = Transform::LookAt(Context.Eye, Context.Center, Vec3f(0, 1, 0));
+			Context.VPMatrix = Transform::Viewport(Width / 8, Height / 8, Width * 3 / 4, Height * 3 / 4);
+			Context.Projection = Transform::Projection(-1. / (Context.Eye - Context.Center).norm());
+			Context.UpdateUniforms();
+
+			PhongShader Shader(Context);
+			for (int FaceIndex = 0; FaceIndex < ModelData.nfaces(); FaceIndex++)
 			{
-				TriangleScreen[VertexIdx] = Shader.Vertex(FaceIndex, VertexIdx);
+				Vec3f ScreenCoords[3];
+				float InvW[3];
+				for (int VertexIdx = 0; VertexIdx < 3; VertexIdx++)
+				{
+					Mat41 Position = Shader.Vertex(FaceIndex, VertexIdx);
+					ScreenCoords[VertexIdx] = Transform::Matrix2Vec(Position);
+					InvW[VertexIdx] = 1.f / Position[3][0];
+				}
+				if (TriangleSetup::IsCulled(TriangleSetup::SignedArea(ScreenCoords), ECullMode::Back))
+				{
+					continue;
+				}
+				Shader.SetupTriangle();
+				Triangle::DrawAndFillTriangleWithShader(ScreenCoords, Shader, Frame.Depth(), Image, bPerspective ? InvW : nullptr);
 			}
 
-			// do the rasterization.
-			Triangle::DrawAndFillTriangleWithShader(TriangleScreen, Shader, ZBuffer, InImage);
+			Image.flip_vertically();
+			Image.write_tga_file(FileNames[bPerspective]);
+			Images[bPerspective] = Image;
 		}
 
-		delete[] ZBuffer;
-		delete ModelData;
+		int Differing = 0, MaxDelta = 0;
+		const int NumBytes = Width*Height*Images[0].get_bytespp();
+		for (int Index = 0; Index < NumBytes; Index += Images[0].get_bytespp())
+		{
+			int Delta = 0;
+			for (int Channel = 0; Channel < Images[0].get_bytespp(); Channel++)
+			{
+				Delta = std::max(Delta, std::abs(Images[0].buffer()[Index + Channel] - Images[1].buffer()[Index + Channel]));
+			}
+			Differing += Delta > 0;
+			MaxDelta = std::max(MaxDelta, Delta);
+		}
+		std::cout << "affine vs perspective correct: " << Differing << " pixels differ, max delta " << MaxDelta << std::endl;
 	}
 
-	void DrawModelWithShadow(TGAImage& InImage)
+	//*************************************************************************
+	// Watertight Rasterization Test
+	//*************************************************************************
+
+	// fills every pixel it is called for, to see which pixels a triangle covers.
+	class CoverageShader final :public ShaderBase<CoverageShader>
 	{
-		// parse model file .obj using utils class Model.
-		ModelData = new Model("C:\\Project\\GitRepos\\GraphicsStudy\\Rasterizer\\Resource\\diablo3_pose.obj");
-		int InWidth = InImage.get_width();
-		int InHeight = InImage.get_height();
+	public:
+		CoverageShader(const RenderContext& InContext) : ShaderBase(InContext) {};
 
-		TGAImage DepthImage(InWidth, InHeight, TGAImage::RGB);
-		float* ZBuffer = new float[InWidth*InHeight];
-		float* ShadowBuffer = new float[InWidth*InHeight];
-		for (int Index = 0; Index < InWidth*InHeight; Index++)
+		virtual Mat41 Vertex(int InFaceIndex, int InVertexIndex) override { return Mat41(); }
+
+		virtual bool Fragment(Vec3f InBarycentric, TGAColor& OutColor) override
 		{
-			ShadowBuffer[Index] = ZBuffer[Index] = -std::numeric_limits<float>::max();
+			OutColor = white;
+			return false;
 		}
+	};
+
+	// plane tessellated into InCells x InCells quads covering the whole image, split along random diagonals.
+	// vertices on even grid lines sit exactly on pixel samples, so horizontal, vertical and diagonal edges run through
+	// samples and the top-left rule decides. the others are jittered to arbitrary sub-pixel positions, little enough to
+	// keep every quad convex. outer border lies between samples.
+	// every triangle is drawn on its own into a region covering its bounding box, then every pixel must have been
+	// drawn by exactly one triangle. runs with every instruction set the cpu has, returns whether all passed.
+	bool WatertightTest(int InCells = 32)
+	{
+		std::mt19937 Random(1234);
+		std::uniform_real_distribution<float> Jitter(-0.2f, 0.2f);
+		const float CellWidth = (float)Width / InCells;
+		const float CellHeight = (float)Height / InCells;
 
-		LightDir.normalize();
-		// now first look at light direction
-		ModelView = Transform::LookAt(LightDir, Center, Vec3f(0, 1, 0));
-		VPMatrix = Transform::Viewport(Width / 4, Height / 4, Width / 2, Height / 2);
-		//Projection = Transform::Projection(-1. / (Eye - Center).norm());
-		// why???
-		Projection = Transform::Projection(0);
+		std::vector<Vec3f> Vertices((InCells + 1)*(InCells + 1));
+		for (int Row = 0; Row <= InCells; Row++)
+		{
+			for (int Column = 0; Column <= InCells; Column++)
+			{
+				Vec3f& Vertex = Vertices[Row*(InCells + 1) + Column];
+				Vertex.x = Column == 0 ? -0.37f : (Column == InCells ? Width - 0.37f : std::floor(Column*CellWidth));
+				Vertex.y = Row == 0 ? -0.37f : (Row == InCells ? Height - 0.37f : std::floor(Row*CellHeight));
+				Vertex.z = 0.f;
+				if (Row % 2 && Column % 2 && Column < InCells && Row < InCells)
+				{
+					Vertex.x += Jitter(Random)*CellWidth;
+					Vertex.y += Jitter(Random)*CellHeight;
+				}
+			}
+		}
 
-		Uniform_M = Projection*ModelView;
-		Uniform_MIT = Uniform_M.Transpose().Inverse();
+		std::vector<Vec3f> Triangles;
+		std::bernoulli_distribution Diagonal(0.5);
+		for (int Row = 0; Row < InCells; Row++)
+		{
+			for (int Column = 0; Column < InCells; Column++)
+			{
+				const Vec3f& V00 = Vertices[Row*(InCells + 1) + Column];
+				const Vec3f& V10 = Vertices[Row*(InCells + 1) + Column + 1];
+				const Vec3f& V01 = Vertices[(Row + 1)*(InCells + 1) + Column];
+				const Vec3f& V11 = Vertices[(Row + 1)*(InCells + 1) + Column + 1];
+				// mixed windings: clockwise triangles are flipped at setup and must fill the same.
+				if (Diagonal(Random))
+				{
+					Triangles.insert(Triangles.end(), { V00, V10, V11, V00, V01, V11 });
+				}
+				else
+				{
+					Triangles.insert(Triangles.end(), { V00, V10, V01, V10, V11, V01 });
+				}
+			}
+		}
 
-		// keep the object to screen transform of first pass.
-		Matrix ObjToScreenM = VPMatrix*Projection*ModelView;
+		RenderContext Context;
+		CoverageShader Shader(Context);
+		const RasterKernel::ELevel SavedLevel = RasterKernel::GetLevel();
+		const RasterKernel::ELevel Levels[] = { RasterKernel::ELevel::Scalar, RasterKernel::ELevel::SSE2, RasterKernel::ELevel::AVX2 };
+		bool bAllPassed = true;
+		for (RasterKernel::ELevel Level : Levels)
+		{
+			RasterKernel::SetLevel(Level);
+			if (RasterKernel::GetLevel() != Level)
+			{
+				continue;
+			}
 
-		// first pass is compute depth shader, to get the info which part was lit, which part was hidden.
-		// so the shadow buffer is z-buffer from light direction.
-		DepthShader FirstPassShader;
+			std::vector<int> Counts(Width*Height, 0);
+			std::vector<float> ZBuffer;
+			std::vector<unsigned char> Color;
+			for (size_t First = 0; First < Triangles.size(); First += 3)
+			{
+				Vec3f* Screen = &Triangles[First];
+				int MinX, MinY, MaxX, MaxY;
+				if (!TriangleSetup::PixelBounds(Screen, Width, Height, MinX, MinY, MaxX, MaxY))
+				{
+					continue;
+				}
 
-		// for each triangle in this model
-		for (int FaceIndex = 0; FaceIndex < ModelData->nfaces(); FaceIndex++)
+				RasterTarget Target;
+				Target.MinX = MinX;
+				Target.MinY = MinY;
+				Target.MaxX = MaxX + 1;
+				Target.MaxY = MaxY + 1;
+				Target.Stride = Target.MaxX - Target.MinX;
+				Target.BytesPP = 1;
+				ZBuffer.assign(Target.Stride*(Target.MaxY - Target.MinY), -std::numeric_limits<float>::max());
+				Color.assign(ZBuffer.size(), 0);
+				Target.ZBuffer = ZBuffer.data();
+				Target.Color = Color.data();
+				Triangle::DrawAndFillTriangleWithShader(Screen, Shader, Target);
+
+				for (int Y = Target.MinY; Y < Target.MaxY; Y++)
+				{
+					for (int X = Target.MinX; X < Target.MaxX; X++)
+					{
+						Counts[Y*Width + X] += Color[(Y - Target.MinY)*Target.Stride + X - Target.MinX] != 0;
+					}
+				}
+			}
+
+			int Missed = 0, Overdrawn = 0;
+			for (int Count : Counts)
+			{
+				Missed += Count == 0;
+				Overdrawn += Count > 1;
+			}
+			const bool bPassed = Missed == 0 && Overdrawn == 0;
+			bAllPassed &= bPassed;
+			std::cout << "watertight " << RasterKernel::GetLevelName(Level) << ": " << Triangles.size() / 3 << " triangles, "
+				<< Missed << " pixels missed, " << Overdrawn << " drawn more than once, " << (bPassed ? "ok" : "FAILED") << std::endl;
+		}
+		RasterKernel::SetLevel(SavedLevel);
+		return bAllPassed;
+	}
+
+	//*************************************************************************
+	// Model Load Benchmark
+	//*************************************************************************
+
+	// the obj parsing loop Model used before objparser: std::getline and a std::istringstream per line.
+	// kept as reference for both speed and result.
+	void ParseObjWithStreams(const char* InFileName, ObjData& OutData)
+	{
+		OutData.clear();
+		OutData.face_starts.push_back(0);
+
+		std::ifstream In(InFileName, std::ifstream::in);
+		std::string Line;
+		while (!In.eof())
 		{
-			std::vector<int> FaceData = ModelData->face(FaceIndex);
-			Vec3f TriangleScreen[3];
+			std::getline(In, Line);
+			std::istringstream Iss(Line.c_str());
+			char Trash;
+			if (!Line.compare(0, 2, "v "))
+			{
+				Iss >> Trash;
+				Vec3f V;
+				for (int i = 0; i < 3; i++) Iss >> V.raw[i];
+				OutData.verts.push_back(V);
+			}
+			else if (!Line.compare(0, 3, "vt "))
+			{
+				Iss >> Trash >> Trash;
+				Vec2f UV;
+				for (int i = 0; i < 2; i++) Iss >> UV.raw[i];
+				OutData.uvs.push_back(UV);
+			}
+			else if (!Line.compare(0, 3, "vn "))
+			{
+				Iss >> Trash >> Trash;
+				Vec3f N;
+				for (int i = 0; i < 3; i++) Iss >> N.raw[i];
+				OutData.norms.push_back(N);
+			}
+			else if (!Line.compare(0, 2, "f "))
+			{
+				Vec3i Corner;
+				Iss >> Trash;
+				while (Iss >> Corner.raw[0] >> Trash >> Corner.raw[1] >> Trash >> Corner.raw[2])
+				{
+					for (int i = 0; i < 3; i++) Corner.raw[i]--;
+					OutData.face_corners.push_back(Corner);
+				}
+				OutData.face_starts.push_back((int)OutData.face_corners.size());
+			}
+		}
+	}
 
-			// call each vertex's vertex shader.
-			for (int VertexIdx = 0; VertexIdx < 3; VertexIdx++)
+	template <class T>
+	bool SameBits(const std::vector<T>& InA, const std::vector<T>& InB)
+	{
+		return InA.size() == InB.size() && (InA.empty() || !memcmp(InA.data(), InB.data(), InA.size() * sizeof(T)));
+	}
+
+	bool SameObjData(const ObjData& InA, const ObjData& InB)
+	{
+		return SameBits(InA.verts, InB.verts) && SameBits(InA.uvs, InB.uvs) && SameBits(InA.norms, InB.norms) &&
+			SameBits(InA.face_corners, InB.face_corners) && SameBits(InA.face_starts, InB.face_starts);
+	}
+
+	// uv sphere with InSegments*InSegments quads split into triangles, written like usual exporters do (6 significant digits).
+	void WriteSyntheticObj(const char* InFileName, int InSegments)
+	{
+		std::ofstream Out(InFileName);
+		for (int Ring = 0; Ring <= InSegments; Ring++)
+		{
+			float Theta = (float)M_PI*Ring / InSegments;
+			for (int Seg = 0; Seg <= InSegments; Seg++)
+			{
+				float Phi = 2.f*(float)M_PI*Seg / InSegments;
+				Vec3f N(std::sin(Theta)*std::cos(Phi), std::cos(Theta), std::sin(Theta)*std::sin(Phi));
+				Out << "v " << N.x << " " << N.y << " " << N.z << "\n";
+				Out << "vt " << (float)Seg / InSegments << " " << (float)Ring / InSegments << "\n";
+				Out << "vn " << N.x << " " << N.y << " " << N.z << "\n";
+			}
+		}
+		for (int Ring = 0; Ring < InSegments; Ring++)
+		{
+			for (int Seg = 0; Seg < InSegments; Seg++)
 			{
-				TriangleScreen[VertexIdx] = FirstPassShader.Vertex(FaceIndex, VertexIdx);
+				int V0 = Ring*(InSegments + 1) + Seg + 1;
+				int V1 = V0 + 1;
+				int V2 = V0 + InSegments + 1;
+				int V3 = V2 + 1;
+				Out << "f " << V0 << "/" << V0 << "/" << V0 << " " << V2 << "/" << V2 << "/" << V2 << " " << V1 << "/" << V1 << "/" << V1 << "\n";
+				Out << "f " << V1 << "/" << V1 << "/" << V1 << " " << V2 << "/" << V2 << "/" << V2 << " " << V3 << "/" << V3 << "/" << V3 << "\n";
 			}
+		}
+	}
 
-			// do the rasterization.
-			Triangle::DrawAndFillTriangleWithShader(TriangleScreen, FirstPassShader, ShadowBuffer, DepthImage);
+	// time the stream parser against objparser on one thread and on all cores, and check all give the same arrays.
+	void ObjLoadBenchmark()
+	{
+		const char* SyntheticFile = "synthetic_sphere.obj";
+		WriteSyntheticObj(SyntheticFile, 700);
+
+		const char* Files[] = {
+			"C:\\Project\\GitRepos\\GraphicsStudy\\Rasterizer\\Resource\\african_head.obj",
+			"C:\\Project\\GitRepos\\GraphicsStudy\\Rasterizer\\Resource\\diablo3_pose.obj",
+			SyntheticFile
+		};
+
+		typedef std::chrono::high_resolution_clock Clock;
+		for (const char* FileName : Files)
+		{
+			// run each one a few times and keep the best, first run also warms the file cache.
+			const int Runs = 3;
+			double StreamMs = 1e30, SingleMs = 1e30, ParallelMs = 1e30;
+			ObjData Reference, Single, Parallel;
+			for (int Run = 0; Run < Runs; Run++)
+			{
+				Clock::time_point Start = Clock::now();
+				ParseObjWithStreams(FileName, Reference);
+				Clock::time_point StreamEnd = Clock::now();
+				load_obj(FileName, Single, 1);
+				Clock::time_point SingleEnd = Clock::now();
+				load_obj(FileName, Parallel);
+				Clock::time_point ParallelEnd = Clock::now();
+
+				StreamMs = std::min(StreamMs, std::chrono::duration<double, std::milli>(StreamEnd - Start).count());
+				SingleMs = std::min(SingleMs, std::chrono::duration<double, std::milli>(SingleEnd - StreamEnd).count());
+				ParallelMs = std::min(ParallelMs, std::chrono::duration<double, std::milli>(ParallelEnd - SingleEnd).count());
+			}
+
+			std::cout << FileName << ": " << Reference.verts.size() << " verts, " << Reference.nfaces() << " faces" << std::endl;
+			std::cout << "  stream parser  " << StreamMs << " ms" << std::endl;
+			std::cout << "  objparser x1   " << SingleMs << " ms (" << StreamMs / SingleMs << "x)" << std::endl;
+			std::cout << "  objparser xN   " << ParallelMs << " ms (" << StreamMs / ParallelMs << "x)" << std::endl;
+			std::cout << "  same result    " << (SameObjData(Reference, Single) && SameObjData(Reference, Parallel) ? "yes" : "NO") << std::endl;
 		}
 
-		// second pass shader
-		Matrix FrameModelView = Transform::LookAt(Eye, Center, Vec3f(0, 1, 0));
-		Matrix FrameVPMatrix = Transform::Viewport(Width / 4, Height / 4, Width / 2, Height / 2);
-		Matrix FrameProjection = Transform::Projection(-1. / (Eye - Center).norm());
+		remove(SyntheticFile);
+	}
 
-		Matrix Uniform_Frame_M = FrameProjection*FrameModelView;
-		Matrix Uniform_Frame_MIT = Uniform_Frame_M.Transpose().Inverse();
+	// Model load time without the mesh cache, when the cache is written (first run), and from the cache.
+	void ModelLoadBenchmark()
+	{
+		const char* Files[] = {
+			"C:\\Project\\GitRepos\\GraphicsStudy\\Rasterizer\\Resource\\african_head.obj",
+			"C:\\Project\\GitRepos\\GraphicsStudy\\Rasterizer\\Resource\\diablo3_pose.obj"
+		};
 
-		// same model vertex in model space, with different transform, we have different frame buffers.
-		// so Transform*vt = VinW; vt = (Transform)^-1*VinW
-		// (T1)^-1*V1 = (T2)^-1*V2, for space 1 and 2.
-		// assume transform from 1 to 2 is M12, then V2 = M12*V1;
-		// so M12 = T2*(T1)^-1.
-		// now we want to solve Frame buffer in Shadow buffer, means Uniform_FrameToShadow_M = Tshadow*(Tframe)^-1.
-		// we have local to screen transform Tshadow, which is ObjToScreenM.
-		// and also Tframe = VPMatrix*Uniform_M
-		Matrix Uniform_FrameToShadow_M = ObjToScreenM*(FrameVPMatrix*Uniform_Frame_M).Inverse();
+		typedef std::chrono::high_resolution_clock Clock;
+		for (const char* FileName : Files)
+		{
+			remove(mesh_cache_filename(FileName).c_str());
+
+			Clock::time_point Start = Clock::now();
+			Model NoCache(FileName, false);
+			Clock::time_point NoCacheEnd = Clock::now();
+			Model FirstRun(FileName);
+			Clock::time_point FirstRunEnd = Clock::now();
+			Model Cached(FileName);
+			Clock::time_point CachedEnd = Clock::now();
+
+			bool bSame = NoCache.nverts() == Cached.nverts() && NoCache.nfaces() == Cached.nfaces();
+			for (int FaceIndex = 0; bSame && FaceIndex < NoCache.nfaces(); FaceIndex++)
+			{
+				for (int VertexIdx = 0; VertexIdx < 3; VertexIdx++)
+				{
+					Vec2f UV = NoCache.uv(FaceIndex, VertexIdx);
+					Vec3f A[] = { NoCache.vert(FaceIndex, VertexIdx), NoCache.norm(FaceIndex, VertexIdx), NoCache.normal(UV) };
+					Vec3f B[] = { Cached.vert(FaceIndex, VertexIdx), Cached.norm(FaceIndex, VertexIdx), Cached.normal(UV) };
+					TGAColor ColorA = NoCache.diffuse(UV);
+					TGAColor ColorB = Cached.diffuse(UV);
+					bSame = bSame && !memcmp(A, B, sizeof(A)) && !memcmp(ColorA.bgra, ColorB.bgra, 4) && NoCache.specular(UV) == Cached.specular(UV);
+				}
+			}
 
-		ShadowShader SecondPassShader(Uniform_Frame_M, Uniform_Frame_MIT, Uniform_FrameToShadow_M, ShadowBuffer);
+			std::cout << FileName << std::endl;
+			std::cout << "  obj + tga      " << std::chrono::duration<double, std::milli>(NoCacheEnd - Start).count() << " ms" << std::endl;
+			std::cout << "  + write cache  " << std::chrono::duration<double, std::milli>(FirstRunEnd - NoCacheEnd).count() << " ms" << std::endl;
+			std::cout << "  mesh cache     " << std::chrono::duration<double, std::milli>(CachedEnd - FirstRunEnd).count() << " ms" << std::endl;
+			std::cout << "  same result    " << (bSame ? "yes" : "NO") << std::endl;
+		}
+	}
 
-		// for each triangle in this model
-		for (int FaceIndex = 0; FaceIndex < ModelData->nfaces(); FaceIndex++)
+	//*************************************************************************
+	// Vertex Cache Benchmark
+	//*************************************************************************
+
+	// shadow depth pass drawn with DrawModel (every corner shaded) and DrawIndexed (post-transform cache).
+	void VertexCacheBenchmark()
+	{
+		const char* Files[] = {
+			"C:\\Project\\GitRepos\\GraphicsStudy\\Rasterizer\\Resource\\african_head.obj",
+			"C:\\Project\\GitRepos\\GraphicsStudy\\Rasterizer\\Resource\\diablo3_pose.obj"
+		};
+
+		typedef std::chrono::high_resolution_clock Clock;
+		for (const char* FileName : Files)
 		{
-			std::vector<int> FaceData = ModelData->face(FaceIndex);
-			Vec3f TriangleScreen[3];
+			Model ModelData(FileName);
+			TGAImage DepthImage(Width, Height, TGAImage::RGB);
+			TGAImage IndexedDepthImage(Width, Height, TGAImage::RGB);
+			std::vector<float> ShadowBuffer(Width*Height, -std::numeric_limits<float>::max());
+			std::vector<float> IndexedShadowBuffer(ShadowBuffer);
+
+			RenderContext Context;
+			InitRenderContext(Context, &ModelData, DepthImage);
+			Context.ModelView = Transform::LookAt(Context.LightDir, Context.Center, Vec3f(0, 1, 0));
+			Context.VPMatrix = Transform::Viewport(Width / 4, Height / 4, Width / 2, Height / 2);
+			Context.Projection = Transform::Projection(0);
+			Context.UpdateUniforms();
+
+			DepthShader Shader(Context);
+			TileRasterizer Rasterizer;
+
+			Clock::time_point Start = Clock::now();
+			Rasterizer.DrawModel(Shader, ModelData.nfaces(), ShadowBuffer.data(), DepthImage);
+			Clock::time_point ModelEnd = Clock::now();
+			VertexCacheStats ModelStats = Rasterizer.GetVertexStats();
+			Rasterizer.DrawIndexed(Shader, ModelData.indices(), IndexedShadowBuffer.data(), IndexedDepthImage);
+			Clock::time_point IndexedEnd = Clock::now();
+			VertexCacheStats IndexedStats = Rasterizer.GetVertexStats();
+
+			bool bSame = ShadowBuffer == IndexedShadowBuffer &&
+				!memcmp(DepthImage.buffer(), IndexedDepthImage.buffer(), Width*Height*DepthImage.get_bytespp());
+
+			std::cout << FileName << ": " << ModelData.nverts() << " verts, " << ModelData.nfaces() << " faces" << std::endl;
+			std::cout << "  DrawModel    " << std::chrono::duration<double, std::milli>(ModelEnd - Start).count() << " ms, "
+				<< ModelStats.ShadedVertices << " vertex shader calls, ACMR " << ModelStats.ACMR() << std::endl;
+			std::cout << "  DrawIndexed  " << std::chrono::duration<double, std::milli>(IndexedEnd - ModelEnd).count() << " ms, "
+				<< IndexedStats.ShadedVertices << " vertex shader calls, ACMR " << IndexedStats.ACMR()
+				<< ", hit rate " << IndexedStats.HitRate() * 100.f << "%" << std::endl;
+			std::cout << "  same result  " << (bSame ? "yes" : "NO") << std::endl;
+		}
+	}
+	//*************************************************************************
+	// Mesh Optimization Report
+	//*************************************************************************
 
-			// call each vertex's vertex shader.
-			for (int VertexIdx = 0; VertexIdx < 3; VertexIdx++)
+	// fifo acmr, overdraw and the DrawIndexed shadow depth pass of each model, as loaded and after optimize_mesh.
+	void MeshOptimizationReport()
+	{
+		const char* Files[] = {
+			"C:\\Project\\GitRepos\\GraphicsStudy\\Rasterizer\\Resource\\african_head.obj",
+			"C:\\Project\\GitRepos\\GraphicsStudy\\Rasterizer\\Resource\\diablo3_pose.obj"
+		};
+		const unsigned Flags[] = { MESH_OPTIMIZE_NONE, MESH_OPTIMIZE_ALL };
+		const char* FlagNames[] = { "as loaded", "optimized" };
+
+		typedef std::chrono::high_resolution_clock Clock;
+		for (const char* FileName : Files)
+		{
+			std::cout << FileName << std::endl;
+			for (int Pass = 0; Pass < 2; Pass++)
 			{
-				TriangleScreen[VertexIdx] = SecondPassShader.Vertex(FaceIndex, VertexIdx);
+				Clock::time_point LoadStart = Clock::now();
+				Model ModelData(FileName, false, Flags[Pass]);
+				Clock::time_point LoadEnd = Clock::now();
+
+				Span<int> Indices = ModelData.indices();
+				float ACMR = analyze_acmr(Indices.data(), Indices.size(), ModelData.nverts());
+				float Overdraw = analyze_overdraw(Indices.data(), Indices.size(), ModelData.verts().data(), ModelData.nverts());
+
+				TGAImage DepthImage(Width, Height, TGAImage::RGB);
+				std::vector<float> ShadowBuffer(Width*Height, -std::numeric_limits<float>::max());
+				RenderContext Context;
+				InitRenderContext(Context, &ModelData, DepthImage);
+				Context.ModelView = Transform::LookAt(Context.LightDir, Context.Center, Vec3f(0, 1, 0));
+				Context.VPMatrix = Transform::Viewport(Width / 4, Height / 4, Width / 2, Height / 2);
+				Context.Projection = Transform::Projection(0);
+				Context.UpdateUniforms();
+
+				DepthShader Shader(Context);
+				TileRasterizer Rasterizer;
+				Clock::time_point DrawStart = Clock::now();
+				Rasterizer.DrawIndexed(Shader, Indices, ShadowBuffer.data(), DepthImage);
+				Clock::time_point DrawEnd = Clock::now();
+				const VertexCacheStats& Stats = Rasterizer.GetVertexStats();
+
+				std::cout << "  " << FlagNames[Pass] << ": load " << std::chrono::duration<double, std::milli>(LoadEnd - LoadStart).count()
+					<< " ms, fifo" << mesh_optimize_cache_size << " ACMR " << ACMR << ", overdraw " << Overdraw
+					<< ", DrawIndexed " << std::chrono::duration<double, std::milli>(DrawEnd - DrawStart).count() << " ms, "
+					<< Stats.ShadedVertices << " vertex shader calls, hit rate " << Stats.HitRate() * 100.f << "%" << std::endl;
 			}
+		}
+	}
 
-			// do the rasterization.
-			Triangle::DrawAndFillTriangleWithShader(TriangleScreen, SecondPassShader, ZBuffer, InImage);
+	//*************************************************************************
+	// Hierarchical Z Benchmark
+	//*************************************************************************
+
+	// Phong shaded frame of each model drawn with and without TileRasterizer's hierarchical z, in the order the faces
+	// are loaded and after optimize_mesh (which sorts clusters of faces front to back). both must give the same image.
+	void HiZBenchmark()
+	{
+		const char* Files[] = {
+			"C:\\Project\\GitRepos\\GraphicsStudy\\Rasterizer\\Resource\\african_head.obj",
+			"C:\\Project\\GitRepos\\GraphicsStudy\\Rasterizer\\Resource\\diablo3_pose.obj"
+		};
+		const unsigned Flags[] = { MESH_OPTIMIZE_NONE, MESH_OPTIMIZE_ALL };
+		const char* FlagNames[] = { "as loaded", "optimized" };
+		const int Runs = 5;
+
+		typedef std::chrono::high_resolution_clock Clock;
+		for (const char* FileName : Files)
+		{
+			std::cout << FileName << std::endl;
+			for (int Pass = 0; Pass < 2; Pass++)
+			{
+				Model ModelData(FileName, true, Flags[Pass]);
+				Framebuffer FrameHiZOff(Width, Height), FrameHiZOn(Width, Height);
+				Framebuffer* Frames[2] = { &FrameHiZOff, &FrameHiZOn };
+				for (int bHiZ = 0; bHiZ < 2; bHiZ++)
+				{
+					TGAImage& Image = Frames[bHiZ]->Color();
+					RenderContext Context;
+					InitRenderContext(Context, &ModelData, Image);
+					Context.ModelView = Transform::LookAt(Context.Eye, Context.Center, Vec3f(0, 1, 0));
+					Context.VPMatrix = Transform::Viewport(Width / 4, Height / 4, Width / 2, Height / 2);
+					Context.Projection = Transform::Projection(-1. / (Context.Eye - Context.Center).norm());
+					Context.UpdateUniforms();
+					PhongShader Shader(Context);
+
+					TileRasterizer Rasterizer;
+					Rasterizer.SetCullMode(ECullMode::Back);
+					Rasterizer.SetHiZEnabled(bHiZ != 0);
+					double BestTime = std::numeric_limits<double>::max();
+					for (int Run = 0; Run < Runs; Run++)
+					{
+						Frames[bHiZ]->Clear();
+						Clock::time_point Start = Clock::now();
+						Rasterizer.DrawIndexed(Shader, ModelData.indices(), Frames[bHiZ]->Depth(), Image);
+						Clock::time_point End = Clock::now();
+						BestTime = std::min(BestTime, std::chrono::duration<double, std::milli>(End - Start).count());
+					}
+
+					const RasterStats& Stats = Rasterizer.GetRasterStats();
+					std::cout << "  " << FlagNames[Pass] << (bHiZ ? ", hi-z on: " : ", hi-z off: ") << BestTime << " ms, "
+						<< Stats.Blocks << " pixel blocks tested, " << Stats.Fragments << " fragments shaded, " << Stats.HiZTriangles << " triangles and "
+						<< Stats.HiZCells << " cells rejected" << std::endl;
+				}
+
+				const bool bSame = memcmp(Frames[0]->Color().buffer(), Frames[1]->Color().buffer(), Width*Height*Frames[0]->Color().get_bytespp()) == 0;
+				std::cout << "  " << FlagNames[Pass] << ": images " << (bSame ? "identical" : "DIFFER") << std::endl;
+			}
 		}
+	}
 
-		delete[] ZBuffer;
-		delete[] ShadowBuffer;
-		delete ModelData;
+	//*************************************************************************
+	// Texture Filter Report
+	//*************************************************************************
+
+	// Phong shaded head drawn at full size and shrunk to a few dozen pixels, with every texture filter.
+	// when shrunk, nearest skips most texels and the image shimmers from frame to frame, mip levels keep it stable.
+	// images go to output_filter_<filter>_<size>.tga, time of the best of a few draws is printed.
+	void TextureFilterReport()
+	{
+		Model ModelData("C:\\Project\\GitRepos\\GraphicsStudy\\Rasterizer\\Resource\\african_head.obj");
+		const TextureFilter Filters[] = { TEXTURE_FILTER_NEAREST, TEXTURE_FILTER_BILINEAR, TEXTURE_FILTER_TRILINEAR };
+		const char* FilterNames[] = { "nearest", "bilinear", "trilinear" };
+		// edge length of the square viewport the head is drawn into.
+		const int Sizes[] = { Width / 2, Width / 16 };
+		const int Runs = 5;
+
+		typedef std::chrono::high_resolution_clock Clock;
+		Framebuffer Frame(Width, Height);
+		TGAImage& Image = Frame.Color();
+		for (int Size : Sizes)
+		{
+			for (int Filter = 0; Filter < 3; Filter++)
+			{
+				ModelData.set_texture_filter(Filters[Filter]);
+				RenderContext Context;
+				InitRenderContext(Context, &ModelData, Image);
+				Context.ModelView = Transform::LookAt(Context.Eye, Context.Center, Vec3f(0, 1, 0));
+				Context.VPMatrix = Transform::Viewport((Width - Size) / 2, (Height - Size) / 2, Size, Size);
+				Context.Projection = Transform::Projection(-1. / (Context.Eye - Context.Center).norm());
+				Context.UpdateUniforms();
+				PhongShader Shader(Context);
+
+				TileRasterizer Rasterizer;
+				Rasterizer.SetCullMode(ECullMode::Back);
+				double BestTime = std::numeric_limits<double>::max();
+				for (int Run = 0; Run < Runs; Run++)
+				{
+					Frame.Clear();
+					Clock::time_point Start = Clock::now();
+					Rasterizer.DrawIndexed(Shader, ModelData.indices(), Frame.Depth(), Image);
+					Clock::time_point End = Clock::now();
+					BestTime = std::min(BestTime, std::chrono::duration<double, std::milli>(End - Start).count());
+				}
+				std::cout << Size << "x" << Size << ", " << FilterNames[Filter] << ": " << BestTime << " ms, "
+					<< Rasterizer.GetRasterStats().Fragments << " fragments" << std::endl;
+
+				std::string FileName = std::string("output_filter_") + FilterNames[Filter] + "_" + std::to_string(Size) + ".tga";
+				Image.flip_vertically();
+				Image.write_tga_file(FileName.c_str());
+			}
+		}
+	}
+
+	//*************************************************************************
+	// Texture Layout Benchmark
+	//*************************************************************************
+
+	// texel coordinates read by TextureLayoutBenchmark, InCount of them over a InWidth x InHeight image.
+	// 0: along rows, 1: along diagonals (x and y both step by one texel), 2: random.
+	void MakeSamplePattern(int InPattern, int InWidth, int InHeight, int InCount, std::vector<Vec2i>& OutCoords)
+	{
+		std::mt19937 Random(7);
+		std::uniform_int_distribution<int> RandomX(0, InWidth - 1), RandomY(0, InHeight - 1);
+		OutCoords.resize(InCount);
+		for (int Index = 0; Index < InCount; Index++)
+		{
+			if (InPattern == 0)
+			{
+				OutCoords[Index] = Vec2i(Index % InWidth, Index / InWidth % InHeight);
+			}
+			else if (InPattern == 1)
+			{
+				// next diagonal starts a few texels further right.
+				OutCoords[Index] = Vec2i((Index + Index / InHeight * 3) % InWidth, Index % InHeight);
+			}
+			else
+			{
+				OutCoords[Index] = Vec2i(RandomX(Random), RandomY(Random));
+			}
+		}
+	}
+
+	// texel reads per second of TGAImage::get and of Texture in the linear and the tiled layout, by nearest fetch and
+	// by bilinear sample at the same texels, for the head's diffuse texture (fits in L2/L3) and a 4096x4096 one (doesn't).
+	// checksums of one column must match, layouts only move texels around.
+	void TextureLayoutBenchmark()
+	{
+		TGAImage Diffuse;
+		Diffuse.read_tga_file("C:\\Project\\GitRepos\\GraphicsStudy\\Rasterizer\\Resource\\african_head_diffuse.tga");
+		TGAImage Noise(4096, 4096, TGAImage::RGB);
+		std::mt19937 Random(3);
+		for (int Index = 0; Index < 4096 * 4096 * 3; Index++)
+		{
+			Noise.buffer()[Index] = (unsigned char)Random();
+		}
+		TGAImage* Images[] = { &Diffuse, &Noise };
+		const char* PatternNames[] = { "row", "diagonal", "random" };
+		const int Count = 1 << 22;
+
+		typedef std::chrono::high_resolution_clock Clock;
+		for (TGAImage* Image : Images)
+		{
+			const int W = Image->get_width(), H = Image->get_height();
+			Texture Linear, Tiled;
+			Linear.build(*Image, TEXTURE_LAYOUT_LINEAR);
+			Tiled.build(*Image, TEXTURE_LAYOUT_TILED);
+			std::cout << W << "x" << H << ", Mtexels/s (checksum)" << std::endl;
+
+			std::vector<Vec2i> Coords;
+			for (int Pattern = 0; Pattern < 3; Pattern++)
+			{
+				MakeSamplePattern(Pattern, W, H, Count, Coords);
+				std::cout << "  " << PatternNames[Pattern] << ":";
+				// 0: TGAImage::get, 1/2: linear/tiled fetch, 3/4: linear/tiled bilinear.
+				for (int Path = 0; Path < 5; Path++)
+				{
+					const Texture& Source = (Path == 1 || Path == 3) ? Linear : Tiled;
+					unsigned Checksum = 0;
+					Clock::time_point Start = Clock::now();
+					for (const Vec2i& Coord : Coords)
+					{
+						TGAColor Color;
+						if (Path == 0)
+						{
+							Color = Image->get(Coord.x, Coord.y);
+						}
+						else if (Path <= 2)
+						{
+							Color = Source.fetch(0, Coord.x, Coord.y);
+						}
+						else
+						{
+							// a quarter texel off the center, so all 4 texels are read.
+							Color = Source.sample_bilinear(Vec2f((Coord.x + 0.75f) / W, (Coord.y + 0.75f) / H), 0);
+						}
+						Checksum += Color.bgra[0] + Color.bgra[1] + Color.bgra[2];
+					}
+					Clock::time_point End = Clock::now();
+					const char* PathNames[] = { "get", "linear fetch", "tiled fetch", "linear bilinear", "tiled bilinear" };
+					std::cout << " " << PathNames[Path] << " " << Count / std::chrono::duration<double, std::micro>(End - Start).count()
+						<< " (" << Checksum << ")";
+				}
+				std::cout << std::endl;
+			}
+		}
+	}
+
+	//*************************************************************************
+	// Pixel Access Benchmark
+	//*************************************************************************
+
+	// fill a 4096x4096 RGB image pixel by pixel with TGAImage::set and through an RGB8 view, and read it back with
+	// TGAImage::get and through the view. memset of the whole image is the memory bandwidth to compare with.
+	void PixelAccessBenchmark()
+	{
+		const int Size = 4096;
+		const int Runs = 5;
+		TGAImage Image(Size, Size, TGAImage::RGB);
+		const double Bytes = (double)Size*Size*TGAImage::RGB;
+
+		typedef std::chrono::high_resolution_clock Clock;
+		const char* Names[] = { "memset", "set", "view write", "get", "view read" };
+		for (int Path = 0; Path < 5; Path++)
+		{
+			double BestTime = std::numeric_limits<double>::max();
+			unsigned Checksum = 0;
+			for (int Run = 0; Run < Runs; Run++)
+			{
+				Clock::time_point Start = Clock::now();
+				if (Path == 0)
+				{
+					memset(Image.buffer(), Run, (size_t)Bytes);
+				}
+				else if (Path == 1)
+				{
+					for (int Y = 0; Y < Size; Y++)
+					{
+						for (int X = 0; X < Size; X++)
+						{
+							Image.set(X, Y, TGAColor(X, Y, Run));
+						}
+					}
+				}
+				else if (Path == 2)
+				{
+					ImageView<RGB8> View = Image.view<RGB8>();
+					for (int Y = 0; Y < Size; Y++)
+					{
+						RGB8* Row = View.row(Y);
+						for (int X = 0; X < Size; X++)
+						{
+							Row[X] = RGB8(TGAColor(X, Y, Run));
+						}
+					}
+				}
+				else if (Path == 3)
+				{
+					for (int Y = 0; Y < Size; Y++)
+					{
+						for (int X = 0; X < Size; X++)
+						{
+							Checksum += Image.get(X, Y).bgra[0];
+						}
+					}
+				}
+				else
+				{
+					ImageView<const RGB8> View = static_cast<const TGAImage&>(Image).view<RGB8>();
+					for (int Y = 0; Y < Size; Y++)
+					{
+						const RGB8* Row = View.row(Y);
+						for (int X = 0; X < Size; X++)
+						{
+							Checksum += Row[X].bgr[0];
+						}
+					}
+				}
+				Clock::time_point End = Clock::now();
+				BestTime = std::min(BestTime, std::chrono::duration<double, std::milli>(End - Start).count());
+			}
+			std::cout << Names[Path] << ": " << BestTime << " ms, " << Bytes / BestTime * 1e-6 << " GB/s";
+			if (Path >= 3)
+			{
+				std::cout << " (checksum " << Checksum << ")";
+			}
+			std::cout << std::endl;
+		}
+	}
+
+	//*************************************************************************
+	// TGA Codec Benchmark
+	//*************************************************************************
+
+	// a shadowed 3840x2160 frame written and read back as rle and as raw tga, time of the best of a few runs.
+	// images read back must equal the frame.
+	void TgaCodecBenchmark()
+	{
+		Model ModelData("C:\\Project\\GitRepos\\GraphicsStudy\\Rasterizer\\Resource\\diablo3_pose.obj");
+		TileRasterizer Rasterizer;
+		Rasterizer.SetCullMode(ECullMode::Back);
+		Framebuffer Frame(3840, 2160, TGAImage::RGB, true);
+		DrawShadowedFrame(Frame, ModelData, Eye, Rasterizer);
+		TGAImage& Image = Frame.Color();
+		const int Runs = 5;
+
+		typedef std::chrono::high_resolution_clock Clock;
+		for (int bRle = 1; bRle >= 0; bRle--)
+		{
+			const char* FileName = bRle ? "output_codec_rle.tga" : "output_codec_raw.tga";
+			double WriteTime = std::numeric_limits<double>::max(), ReadTime = std::numeric_limits<double>::max();
+			TGAImage ReadBack;
+			for (int Run = 0; Run < Runs; Run++)
+			{
+				Clock::time_point Start = Clock::now();
+				Image.write_tga_file(FileName, bRle != 0);
+				Clock::time_point Written = Clock::now();
+				ReadBack.read_tga_file(FileName);
+				Clock::time_point End = Clock::now();
+				WriteTime = std::min(WriteTime, std::chrono::duration<double, std::milli>(Written - Start).count());
+				ReadTime = std::min(ReadTime, std::chrono::duration<double, std::milli>(End - Written).count());
+			}
+
+			std::ifstream File(FileName, std::ios::binary | std::ios::ate);
+			const bool bSame = ReadBack.get_width() == Image.get_width() && ReadBack.get_height() == Image.get_height() &&
+				memcmp(ReadBack.buffer(), Image.buffer(), Image.row_bytes()*Image.get_height()) == 0;
+			std::cout << (bRle ? "rle: " : "raw: ") << File.tellg() << " bytes, write " << WriteTime << " ms, read " << ReadTime << " ms, "
+				<< (bSame ? "identical" : "DIFFERENT") << std::endl;
+		}
+	}
+
+	//*************************************************************************
+	// Texture Map Benchmark
+	//*************************************************************************
+
+	// 4096x4096 uncompressed tga made into a Texture: read into a TGAImage and built (what Model does with rle files),
+	// mapped in the linear layout (level 0 used in place) and mapped in the tiled layout (copied from the mapping).
+	// prints time and heap bytes of each and checks all read the same texels.
+	void TextureMapBenchmark()
+	{
+		const int Size = 4096;
+		const char* FileName = "output_texture_raw.tga";
+		{
+			TGAImage Image(Size, Size, TGAImage::RGB);
+			for (int Y = 0; Y < Size; Y++)
+			{
+				RGB8* Row = reinterpret_cast<RGB8*>(Image.row(Y));
+				for (int X = 0; X < Size; X++)
+				{
+					Row[X] = RGB8(TGAColor((unsigned char)X, (unsigned char)Y, (unsigned char)(X ^ Y), 255));
+				}
+			}
+			Image.write_tga_file(FileName, false);
+		}
+
+		typedef std::chrono::high_resolution_clock Clock;
+		const char* Names[] = { "read and build", "map linear", "map tiled" };
+		Texture Textures[3];
+		for (int Method = 0; Method < 3; Method++)
+		{
+			Clock::time_point Start = Clock::now();
+			if (Method == 0)
+			{
+				TGAImage Image;
+				Image.read_tga_file(FileName);
+				Image.flip_vertically();
+				Textures[Method].build(Image);
+			}
+			else
+			{
+				Textures[Method].map(FileName, Method == 1 ? TEXTURE_LAYOUT_LINEAR : TEXTURE_LAYOUT_TILED);
+			}
+			Clock::time_point End = Clock::now();
+			std::cout << Names[Method] << ": " << std::chrono::duration<double, std::milli>(End - Start).count() << " ms, "
+				<< Textures[Method].size() << " bytes on the heap" << (Textures[Method].mapped() ? ", mapped" : "") << std::endl;
+		}
+
+		bool bSame = !Textures[1].empty() && !Textures[2].empty() && Textures[0].levels() == Textures[1].levels() && Textures[0].levels() == Textures[2].levels();
+		for (int Level = 0; bSame && Level < Textures[0].levels(); Level++)
+		{
+			for (int Y = 0; bSame && Y < Textures[0].height(Level); Y += 7)
+			{
+				for (int X = 0; X < Textures[0].width(Level); X += 5)
+				{
+					const TGAColor Expected = Textures[0].fetch(Level, X, Y);
+					for (int Method = 1; Method < 3; Method++)
+					{
+						const TGAColor Actual = Textures[Method].fetch(Level, X, Y);
+						bSame = bSame && memcmp(Expected.bgra, Actual.bgra, 3) == 0;
+					}
+				}
+			}
+		}
+		std::cout << (bSame ? "all identical" : "DIFFERENT") << std::endl;
+
+		// a Model with uncompressed textures keeps them mapped: only the levels after 0 are on the heap.
+		const char* ObjName = "output_texture_model.obj";
+		const char* Suffixes[] = { "_diffuse.tga", "_nm.tga", "_spec.tga" };
+		WriteSyntheticObj(ObjName, 16);
+		{
+			TGAImage Image;
+			Image.read_tga_file(FileName);
+			Image.scale(256, 256);
+			for (const char* Suffix : Suffixes)
+			{
+				Image.write_tga_file((std::string("output_texture_model") + Suffix).c_str(), false);
+			}
+		}
+		Model TexturedModel(ObjName, false);
+		const Texture* Maps[] = { &TexturedModel.diffusemap(), &TexturedModel.normalmap(), &TexturedModel.specularmap() };
+		bool bMapped = true;
+		for (const Texture* Map : Maps)
+		{
+			size_t Expected = 0;
+			for (int Level = 1; Level < Map->levels(); Level++)
+			{
+				Expected += (size_t)Map->width(Level)*Map->height(Level)*Map->bytespp();
+			}
+			bMapped = bMapped && !Map->empty() && Map->mapped() && Map->size() == Expected;
+		}
+		std::cout << "model textures " << (bMapped ? "mapped in place" : "NOT MAPPED") << std::endl;
+	}
+
+	//*************************************************************************
+	// Image Move Benchmark
+	//*************************************************************************
+
+	// 3840x2160 images stored in a std::vector by copy and by move, and an image made for every frame of changing
+	// size by constructing a new one and by resize, which reuses the buffer of the largest size so far.
+	void ImageMoveBenchmark()
+	{
+		const int ImageWidth = 3840, ImageHeight = 2160;
+		const int Count = 8;
+		typedef std::chrono::high_resolution_clock Clock;
+
+		for (int bMove = 0; bMove <= 1; bMove++)
+		{
+			std::vector<TGAImage> Images;
+			double Time = 0;
+			for (int Index = 0; Index < Count; Index++)
+			{
+				TGAImage Image(ImageWidth, ImageHeight, TGAImage::RGB);
+				Clock::time_point Start = Clock::now();
+				if (bMove)
+				{
+					Images.push_back(std::move(Image));
+				}
+				else
+				{
+					Images.push_back(Image);
+				}
+				Time += std::chrono::duration<double, std::milli>(Clock::now() - Start).count();
+			}
+			std::cout << (bMove ? "push_back move: " : "push_back copy: ") << Time / Count << " ms per image" << std::endl;
+		}
+
+		const int Frames = 60;
+		for (int bResize = 0; bResize <= 1; bResize++)
+		{
+			TGAImage Image;
+			Clock::time_point Start = Clock::now();
+			for (int FrameIndex = 0; FrameIndex < Frames; FrameIndex++)
+			{
+				const int FrameWidth = ImageWidth - (FrameIndex % 4)*16;
+				if (bResize)
+				{
+					Image.resize(FrameWidth, ImageHeight, TGAImage::RGB);
+				}
+				else
+				{
+					Image = TGAImage(FrameWidth, ImageHeight, TGAImage::RGB);
+				}
+			}
+			std::cout << (bResize ? "resize: " : "new image: ") << std::chrono::duration<double, std::milli>(Clock::now() - Start).count() / Frames
+				<< " ms per frame" << std::endl;
+		}
 	}
 }
 
 int main(int argc, char** argv) 
 {
-	TGAImage image(Width, Height, TGAImage::RGB);
+	// color image of Frame is what gets written.
+	Framebuffer Frame(Width, Height, TGAImage::RGB, true);
+	TGAImage& image = Frame.Color();
 
 	//DrawLineTest(image);
 	//DrawModelWireFrameTest(Width, Height, image);
@@ -520,8 +1613,24 @@ int main(int argc, char** argv)
 	//DrawModelWithPerspectiveProjection(Width, Height, image);
 	//DrawModelGouraudShading(Width, Height, image);
 	
-	//DrawModelByShader(image);
-	DrawModelWithShadow(image);
+	//DrawModelByShader(Frame);
+	//ConcurrentRenderTest();
+	//ClippingTest();
+	//TurntableTest();
+	//PerspectiveTest();
+	//WatertightTest();
+	//ObjLoadBenchmark();
+	//ModelLoadBenchmark();
+	//VertexCacheBenchmark();
+	//MeshOptimizationReport();
+	//HiZBenchmark();
+	//TextureFilterReport();
+	//TextureLayoutBenchmark();
+	//PixelAccessBenchmark();
+	//TgaCodecBenchmark();
+	//TextureMapBenchmark();
+	//ImageMoveBenchmark();
+	DrawModelWithShadow(Frame);
 
 	image.flip_vertically(); // i want to have the origin at the left bottom corner of the image
 	image.write_tga_file("output.tga");
@@ -2,6 +2,7 @@
 #define __GEOMETRY_H__
 
 #include <cmath>
+#include <cassert>
 #include <vector>
 #include <iostream>
 
@@ -65,30 +66,183 @@ template <typename t> Vec3<t> cross(Vec3<t> v1, Vec3<t> v2) {
 //**********************************************************************
 //                         Matrix
 //**********************************************************************
-class Matrix
+// fixed size row-major matrix. elements are stored inline, so matrices live on the stack
+// and transforming a vertex (e.g. VPMatrix*Projection*ModelView*Vec2Matrix(v)) never touches the heap.
+template <int Rows, int Cols> class Mat
 {
 public:
-	Matrix(int InRow = 4, int InCol = 4);
-
-	inline int NRows() { return Rows; }
-	inline int NCols() { return Cols; }
-
-	void SetRow(size_t InRowIdx, Vec3f InVec);
-	void SetCol(size_t InColIdx, Vec3f InVec);
-
-	static Matrix Identity(int InDimensions);
-	std::vector<float>& operator[](const int i);
-	Matrix operator*(const Matrix& InM);
-	Matrix Transpose();
-	Matrix Inverse();
-
-	friend std::ostream& operator<<(std::ostream& s, Matrix& m);
+	Mat()
+	{
+		for (int RowIndex = 0; RowIndex < Rows; RowIndex++)
+		{
+			for (int ColIndex = 0; ColIndex < Cols; ColIndex++)
+			{
+				Elements[RowIndex][ColIndex] = 0.f;
+			}
+		}
+	}
+
+	static int NRows() { return Rows; }
+	static int NCols() { return Cols; }
+
+	void SetRow(int InRowIdx, Vec3f InVec)
+	{
+		assert(InRowIdx < Rows && Cols <= 3);
+		for (int i = Cols; i--; Elements[InRowIdx][i] = InVec.raw[i]);
+	}
+
+	void SetCol(int InColIdx, Vec3f InVec)
+	{
+		assert(InColIdx < Cols && Rows <= 3);
+		for (int i = Rows; i--; Elements[i][InColIdx] = InVec.raw[i]);
+	}
+
+	static Mat<Rows, Cols> Identity()
+	{
+		Mat<Rows, Cols> IMatrix;
+		for (int Index = 0; Index < Rows && Index < Cols; Index++)
+		{
+			IMatrix[Index][Index] = 1.f;
+		}
+		return IMatrix;
+	}
+
+	inline float* operator[](const int i)
+	{
+		assert(i >= 0 && i < Rows);
+		return Elements[i];
+	}
+
+	inline const float* operator[](const int i) const
+	{
+		assert(i >= 0 && i < Rows);
+		return Elements[i];
+	}
+
+	template <int OtherCols>
+	inline Mat<Rows, OtherCols> operator*(const Mat<Cols, OtherCols>& InM) const
+	{
+		Mat<Rows, OtherCols> Result;
+		for (int RowIndex = 0; RowIndex < Rows; RowIndex++)
+		{
+			for (int ColIndex = 0; ColIndex < OtherCols; ColIndex++)
+			{
+				float Sum = .0f;
+				for (int k = 0; k < Cols; k++)
+				{
+					// fix row of this matrix multiply col of that matrix
+					Sum += Elements[RowIndex][k] * InM[k][ColIndex];
+				}
+				Result[RowIndex][ColIndex] = Sum;
+			}
+		}
+		return Result;
+	}
+
+	inline Mat<Cols, Rows> Transpose() const
+	{
+		Mat<Cols, Rows> TransposeMatix;
+		for (int RowIndex = 0; RowIndex < Cols; RowIndex++)
+		{
+			for (int ColIndex = 0; ColIndex < Rows; ColIndex++)
+			{
+				TransposeMatix[RowIndex][ColIndex] = Elements[ColIndex][RowIndex];
+			}
+		}
+		return TransposeMatix;
+	}
+
+	// Gauss-Jordan elimination on the augmented matrix [M|I], done in a stack array.
+	inline Mat<Rows, Cols> Inverse() const
+	{
+		static_assert(Rows == Cols, "only square matrix can be inverted");
+		const int AugCols = Cols * 2;
+		float Result[Rows][Cols * 2];
+
+		for (int RowIndex = 0; RowIndex < Rows; RowIndex++)
+		{
+			for (int ColIndex = 0; ColIndex < Cols; ColIndex++)
+			{
+				Result[RowIndex][ColIndex] = Elements[RowIndex][ColIndex];
+				Result[RowIndex][ColIndex + Cols] = (RowIndex == ColIndex) ? 1.f : 0.f;
+			}
+		}
+
+		// first pass
+		for (int i = 0; i < Rows - 1; i++)
+		{
+			// normalize the first row
+			for (int j = AugCols - 1; j >= 0; j--)
+			{
+				Result[i][j] /= Result[i][i];
+			}
+
+			for (int k = i + 1; k < Rows; k++)
+			{
+				float coeff = Result[k][i];
+				for (int j = 0; j < AugCols; j++)
+				{
+					Result[k][j] -= Result[i][j] * coeff;
+				}
+			}
+		}
+
+		// normalize the last row
+		for (int j = AugCols - 1; j >= Rows - 1; j--)
+		{
+			Result[Rows - 1][j] /= Result[Rows - 1][Rows - 1];
+		}
+
+		// second pass
+		for (int i = Rows - 1; i > 0; i--)
+		{
+			for (int k = i - 1; k >= 0; k--)
+			{
+				float coeff = Result[k][i];
+				for (int j = 0; j < AugCols; j++)
+				{
+					Result[k][j] -= Result[i][j] * coeff;
+				}
+			}
+		}
+
+		// cut the identity matrix back
+		Mat<Rows, Cols> Truncate;
+		for (int i = 0; i < Rows; i++)
+		{
+			for (int j = 0; j < Cols; j++)
+			{
+				Truncate[i][j] = Result[i][j + Cols];
+			}
+		}
+		return Truncate;
+	}
 
 private:
-	std::vector<std::vector<float>> Elements;
-	int Rows;
-	int Cols;
+	float Elements[Rows][Cols];
 };
 
+typedef Mat<4, 4> Mat4;
+typedef Mat<3, 3> Mat3;
+typedef Mat<4, 1> Mat41; // column vector, homogeneous point or vector.
+typedef Mat<1, 3> Mat13; // row vector.
+
+template <int Rows, int Cols> std::ostream& operator<<(std::ostream& s, const Mat<Rows, Cols>& m)
+{
+	for (int RowIndex = 0; RowIndex < Rows; RowIndex++)
+	{
+		for (int ColIndex = 0; ColIndex < Cols; ColIndex++)
+		{
+			s << m[RowIndex][ColIndex];
+			if (ColIndex < Cols - 1)
+			{
+				s << "\t";
+			}
+		}
+		s << "\n";
+	}
+	return s;
+}
+
 
 #endif //__GEOMETRY_H__
\ No newline at end of file
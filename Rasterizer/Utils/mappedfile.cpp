@@ -0,0 +1,100 @@
+#include "mappedfile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+MappedFile::MappedFile() : data_(NULL), size_(0), opened_(false), file_(INVALID_HANDLE_VALUE), mapping_(NULL) {
+}
+#else
+MappedFile::MappedFile() : data_(NULL), size_(0), opened_(false) {
+}
+#endif
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+#ifdef _WIN32
+bool MappedFile::open(const char *filename) {
+	close();
+	file_ = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file_ == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER filesize;
+	if (!GetFileSizeEx(file_, &filesize)) {
+		close();
+		return false;
+	}
+	size_ = (size_t)filesize.QuadPart;
+	if (size_ > 0) {
+		mapping_ = CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (!mapping_) {
+			close();
+			return false;
+		}
+		data_ = (const char *)MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+		if (!data_) {
+			close();
+			return false;
+		}
+	}
+	opened_ = true;
+	return true;
+}
+
+void MappedFile::close() {
+	if (data_) UnmapViewOfFile(data_);
+	if (mapping_) CloseHandle(mapping_);
+	if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+	data_ = NULL;
+	mapping_ = NULL;
+	file_ = INVALID_HANDLE_VALUE;
+	size_ = 0;
+	opened_ = false;
+}
+#else
+bool MappedFile::open(const char *filename) {
+	close();
+	int fd = ::open(filename, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		::close(fd);
+		return false;
+	}
+	size_ = (size_t)st.st_size;
+	if (size_ > 0) {
+		void *mapped = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapped == MAP_FAILED) {
+			::close(fd);
+			size_ = 0;
+			return false;
+		}
+		madvise(mapped, size_, MADV_SEQUENTIAL);
+		data_ = (const char *)mapped;
+	}
+	// the mapping keeps its own reference to the file.
+	::close(fd);
+	opened_ = true;
+	return true;
+}
+
+void MappedFile::close() {
+	if (data_) munmap((void *)data_, size_);
+	data_ = NULL;
+	size_ = 0;
+	opened_ = false;
+}
+#endif
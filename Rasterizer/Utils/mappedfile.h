@@ -0,0 +1,34 @@
+#ifndef __MAPPEDFILE_H__
+#define __MAPPEDFILE_H__
+
+#include <stddef.h>
+
+// read only memory mapping of a whole file.
+// the bytes are paged in from the os file cache on first touch, nothing is copied into the process heap.
+class MappedFile {
+public:
+	MappedFile();
+	~MappedFile();
+
+	bool open(const char *filename);
+	void close();
+	bool is_open() const { return opened_; }
+
+	// mapped bytes of the file, NOT null terminated. data() is NULL for an empty file.
+	const char *data() const { return data_; }
+	size_t size() const { return size_; }
+
+private:
+	MappedFile(const MappedFile &);
+	MappedFile & operator =(const MappedFile &);
+
+	const char *data_;
+	size_t size_;
+	bool opened_;
+#ifdef _WIN32
+	void *file_;
+	void *mapping_;
+#endif
+};
+
+#endif //__MAPPEDFILE_H__
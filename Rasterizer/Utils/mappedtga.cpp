@@ -0,0 +1,57 @@
+#include <string.h>
+#include "mappedtga.h"
+
+MappedTGA::MappedTGA() : first_row_(NULL), stride_(0), width_(0), height_(0), bytespp_(0) {
+}
+
+bool MappedTGA::open(const char *filename) {
+	close();
+	if (!file_.open(filename) || file_.size() < sizeof(TGA_Header)) {
+		close();
+		return false;
+	}
+	TGA_Header header;
+	memcpy(&header, file_.data(), sizeof(header));
+	const int bytespp = header.bitsperpixel >> 3;
+	const bool uncompressed = header.datatypecode == 2 || header.datatypecode == 3;
+	if (!uncompressed || header.width <= 0 || header.height <= 0 || (header.imagedescriptor & 0x10) ||
+		(bytespp != TGAImage::GRAYSCALE && bytespp != TGAImage::RGB && bytespp != TGAImage::RGBA)) {
+		close();
+		return false;
+	}
+	const size_t offset = sizeof(header) + (unsigned char)header.idlength;
+	const size_t row_bytes = (size_t)header.width*bytespp;
+	if (file_.size() < offset + row_bytes*header.height) {
+		close();
+		return false;
+	}
+
+	width_ = header.width;
+	height_ = header.height;
+	bytespp_ = bytespp;
+	const unsigned char *pixels = (const unsigned char *)file_.data() + offset;
+	if (header.imagedescriptor & 0x20) {
+		// stored top down: bottom row is the last one.
+		first_row_ = pixels + row_bytes*(height_ - 1);
+		stride_ = -(ptrdiff_t)row_bytes;
+	}
+	else {
+		first_row_ = pixels;
+		stride_ = (ptrdiff_t)row_bytes;
+	}
+	return true;
+}
+
+void MappedTGA::close() {
+	file_.close();
+	first_row_ = NULL;
+	stride_ = 0;
+	width_ = height_ = bytespp_ = 0;
+}
+
+TGAColor MappedTGA::get(int x, int y) const {
+	if (!first_row_ || x < 0 || y < 0 || x >= width_ || y >= height_) {
+		return TGAColor();
+	}
+	return TGAColor(row(y) + x*bytespp_, bytespp_);
+}
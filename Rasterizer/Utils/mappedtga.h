@@ -0,0 +1,43 @@
+#ifndef __MAPPEDTGA_H__
+#define __MAPPEDTGA_H__
+
+#include <stddef.h>
+#include "mappedfile.h"
+#include "tgaimage.h"
+
+// Read only view of the pixels of an uncompressed tga file, mapped into memory (see MappedFile): opening reads the
+// header only, pixels are paged in from the os file cache when touched and shared by every process mapping the file.
+// rows are addressed bottom up, row 0 being the bottom of the picture (tga's own default, and how Model uses
+// textures), whatever origin the file was stored with: row(y) walks the file forwards or backwards, nothing is flipped.
+class MappedTGA {
+public:
+	MappedTGA();
+
+	// false for rle compressed or right to left stored files, which have to be decoded into a TGAImage.
+	bool open(const char *filename);
+	void close();
+	bool is_open() const { return first_row_ != NULL; }
+
+	int get_width() const { return width_; }
+	int get_height() const { return height_; }
+	int get_bytespp() const { return bytespp_; }
+	// bytes from row y to row y + 1, negative for files stored top down.
+	ptrdiff_t stride() const { return stride_; }
+	// unchecked, get_width() pixels of row y.
+	const unsigned char *row(int y) const { return first_row_ + y*stride_; }
+	// checked like TGAImage::get.
+	TGAColor get(int x, int y) const;
+
+private:
+	MappedTGA(const MappedTGA &);
+	MappedTGA & operator =(const MappedTGA &);
+
+	MappedFile file_;
+	const unsigned char *first_row_;
+	ptrdiff_t stride_;
+	int width_;
+	int height_;
+	int bytespp_;
+};
+
+#endif //__MAPPEDTGA_H__
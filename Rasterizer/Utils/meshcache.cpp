@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <string.h>
+#include <fstream>
+#include <string>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "meshcache.h"
+#include "mappedfile.h"
+
+namespace {
+	const char mesh_cache_magic[8] = { 'R', 'M', 'E', 'S', 'H', 'C', 'H', 'E' };
+	// bump when the layout or the content of any section changes.
+	const unsigned mesh_cache_version = 4;
+	const size_t section_alignment = 16;
+
+	struct FileStamp {
+		long long size; // -1 when the file doesn't exist
+		long long mtime;
+	};
+
+	struct Section {
+		unsigned long long offset;
+		unsigned long long count;
+	};
+
+	struct TextureInfo {
+		FileStamp source;
+		int width;
+		int height;
+		int bytespp;
+		int pad;
+		Section pixels;
+	};
+
+	struct MeshCacheHeader {
+		char magic[8];
+		unsigned version;
+		unsigned header_size; // also guards against a different struct packing
+		FileStamp source;
+		Section positions;
+		Section uvs;
+		Section normals;
+		Section indices;
+		int ntextures;
+		unsigned optimize_flags; // MeshOptimizeFlags applied to the mesh
+		TextureInfo textures[mesh_cache_max_textures];
+	};
+
+	FileStamp file_stamp(const char *filename) {
+		FileStamp stamp;
+		stamp.size = -1;
+		stamp.mtime = 0;
+#ifdef _WIN32
+		struct __stat64 st;
+		if (_stat64(filename, &st) == 0) {
+#else
+		struct stat st;
+		if (stat(filename, &st) == 0) {
+#endif
+			stamp.size = (long long)st.st_size;
+			stamp.mtime = (long long)st.st_mtime;
+		}
+		return stamp;
+	}
+
+	bool same_stamp(const FileStamp &a, const FileStamp &b) {
+		return a.size == b.size && a.mtime == b.mtime;
+	}
+
+	size_t align_up(size_t offset) {
+		return (offset + section_alignment - 1) & ~(section_alignment - 1);
+	}
+
+	// section must lie inside the mapped file.
+	bool valid_section(const Section &section, size_t element_size, size_t file_size) {
+		return section.offset <= file_size && section.count <= (file_size - section.offset) / element_size;
+	}
+
+	// whole triangles, every index naming one of nverts vertices.
+	bool valid_indices(const std::vector<int> &indices, size_t nverts) {
+		if (indices.size() % 3) return false;
+		for (size_t i = 0; i < indices.size(); i++) {
+			if (indices[i] < 0 || (size_t)indices[i] >= nverts) return false;
+		}
+		return true;
+	}
+
+	template <class T> bool read_section(const MappedFile &file, const Section &section, std::vector<T> &out) {
+		if (!valid_section(section, sizeof(T), file.size())) return false;
+		out.resize((size_t)section.count);
+		if (section.count) memcpy(out.data(), file.data() + section.offset, (size_t)section.count * sizeof(T));
+		return true;
+	}
+
+	// append bytes at the next aligned offset.
+	Section write_section(std::ofstream &out, size_t &offset, const void *data, size_t count, size_t element_size) {
+		static const char zeros[section_alignment] = {};
+		size_t aligned = align_up(offset);
+		out.write(zeros, aligned - offset);
+		out.write((const char *)data, count * element_size);
+		offset = aligned + count * element_size;
+
+		Section section;
+		section.offset = aligned;
+		section.count = count;
+		return section;
+	}
+}
+
+std::string mesh_cache_filename(const char *filename) {
+	return std::string(filename) + ".meshcache";
+}
+
+bool read_mesh_cache(const char *filename, const char *const *texture_files, int ntextures, unsigned optimize_flags, IndexedMesh &mesh, TGAImage *const *textures) {
+	if (ntextures > mesh_cache_max_textures) return false;
+	std::string cachefile = mesh_cache_filename(filename);
+	MappedFile file;
+	if (!file.open(cachefile.c_str()) || file.size() < sizeof(MeshCacheHeader)) return false;
+
+	MeshCacheHeader header;
+	memcpy(&header, file.data(), sizeof(header));
+	if (memcmp(header.magic, mesh_cache_magic, sizeof(mesh_cache_magic)) || header.version != mesh_cache_version ||
+		header.header_size != sizeof(MeshCacheHeader) || header.ntextures != ntextures || header.optimize_flags != optimize_flags) {
+		return false;
+	}
+
+	// stale when any source changed since the cache was written.
+	if (!same_stamp(header.source, file_stamp(filename))) return false;
+	for (int i = 0; i < ntextures; i++) {
+		if (!same_stamp(header.textures[i].source, file_stamp(texture_files[i]))) return false;
+	}
+
+	if (!read_section(file, header.positions, mesh.positions) || !read_section(file, header.uvs, mesh.uvs) ||
+		!read_section(file, header.normals, mesh.normals) || !read_section(file, header.indices, mesh.indices) ||
+		mesh.uvs.size() != mesh.positions.size() || mesh.normals.size() != mesh.positions.size() ||
+		!valid_indices(mesh.indices, mesh.positions.size())) {
+		mesh.clear();
+		return false;
+	}
+
+	for (int i = 0; i < ntextures; i++) {
+		const TextureInfo &info = header.textures[i];
+		size_t nbytes = (size_t)info.width * info.height * info.bytespp;
+		if (info.width < 0 || info.height < 0 || info.bytespp < 0 || info.pixels.count != nbytes || !valid_section(info.pixels, 1, file.size())) {
+			mesh.clear();
+			return false;
+		}
+		if (!textures[i]) continue;
+		if (nbytes == 0) {
+			*textures[i] = TGAImage();
+			continue;
+		}
+		textures[i]->resize(info.width, info.height, info.bytespp);
+		memcpy(textures[i]->buffer(), file.data() + info.pixels.offset, nbytes);
+	}
+	return true;
+}
+
+bool write_mesh_cache(const char *filename, const char *const *texture_files, int ntextures, unsigned optimize_flags, const IndexedMesh &mesh, TGAImage *const *textures) {
+	if (ntextures > mesh_cache_max_textures) return false;
+
+	MeshCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, mesh_cache_magic, sizeof(mesh_cache_magic));
+	header.version = mesh_cache_version;
+	header.header_size = sizeof(MeshCacheHeader);
+	header.source = file_stamp(filename);
+	header.ntextures = ntextures;
+	header.optimize_flags = optimize_flags;
+
+	// written to a temporary file first, so a reader never maps a half written cache.
+	std::string cachefile = mesh_cache_filename(filename);
+	std::string tmpfile = cachefile + ".tmp";
+	std::ofstream out(tmpfile.c_str(), std::ios::binary);
+	if (!out.is_open()) return false;
+
+	// header is written again once all offsets are known.
+	out.write((const char *)&header, sizeof(header));
+	size_t offset = sizeof(header);
+	header.positions = write_section(out, offset, mesh.positions.data(), mesh.positions.size(), sizeof(Vec3f));
+	header.uvs = write_section(out, offset, mesh.uvs.data(), mesh.uvs.size(), sizeof(Vec2f));
+	header.normals = write_section(out, offset, mesh.normals.data(), mesh.normals.size(), sizeof(Vec3f));
+	header.indices = write_section(out, offset, mesh.indices.data(), mesh.indices.size(), sizeof(int));
+	for (int i = 0; i < ntextures; i++) {
+		TextureInfo &info = header.textures[i];
+		info.source = file_stamp(texture_files[i]);
+		const TGAImage empty;
+		const TGAImage &img = textures[i] ? *textures[i] : empty;
+		info.width = img.get_width();
+		info.height = img.get_height();
+		info.bytespp = img.get_bytespp();
+		size_t nbytes = img.buffer() ? (size_t)info.width * info.height * info.bytespp : 0;
+		if (!nbytes) info.width = info.height = info.bytespp = 0;
+		info.pixels = write_section(out, offset, img.buffer(), nbytes, 1);
+	}
+	out.seekp(0);
+	out.write((const char *)&header, sizeof(header));
+	out.close();
+	if (out.fail()) {
+		remove(tmpfile.c_str());
+		return false;
+	}
+
+	remove(cachefile.c_str());
+	if (rename(tmpfile.c_str(), cachefile.c_str()) != 0) {
+		remove(tmpfile.c_str());
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,23 @@
+#ifndef __MESHCACHE_H__
+#define __MESHCACHE_H__
+
+#include "objparser.h"
+#include "tgaimage.h"
+
+// Binary cache of a parsed obj file and its textures, written next to the obj as "<obj>.meshcache".
+// layout: MeshCacheHeader, then the IndexedMesh arrays and the texture pixels (already flipped like Model uses them),
+// every section 16 byte aligned. loading maps the file and copies the sections out, nothing is parsed or decoded.
+// the header keeps size and modification time of the obj and of every texture file, the cache is
+// ignored (and rewritten by Model) when any of them changed, or when it was written by another version
+// or with other optimize_flags (see meshopt.h).
+
+const int mesh_cache_max_textures = 4;
+
+// ntextures images are read/written in the order of texture_files, an image which failed to load is cached as empty.
+// a NULL entry of textures is skipped on read and cached as empty on write (e.g. a texture mapped from its file).
+bool read_mesh_cache(const char *filename, const char *const *texture_files, int ntextures, unsigned optimize_flags, IndexedMesh &mesh, TGAImage *const *textures);
+bool write_mesh_cache(const char *filename, const char *const *texture_files, int ntextures, unsigned optimize_flags, const IndexedMesh &mesh, TGAImage *const *textures);
+
+std::string mesh_cache_filename(const char *filename);
+
+#endif //__MESHCACHE_H__
@@ -0,0 +1,351 @@
+#include <math.h>
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include "meshopt.h"
+
+namespace {
+	// vertex score constants from Tom Forsyth's article.
+	const float cache_decay_power = 1.5f;
+	const float last_tri_score = 0.75f;
+	const float valence_boost_scale = 2.0f;
+	const float valence_boost_power = 0.5f;
+
+	const int overdraw_grid_size = 256;
+
+	float vertex_score(int cache_position, int remaining, int cache_size) {
+		if (remaining == 0) return -1.f; // no triangle left, never needed again
+		float score = 0.f;
+		if (cache_position >= 0) {
+			// vertices of the last triangle get a fixed score, so the next triangle doesn't just go back and forth.
+			if (cache_position < 3) score = last_tri_score;
+			else score = powf(1.f - (float)(cache_position - 3) / (cache_size - 3), cache_decay_power);
+		}
+		// boost vertices with few triangles left, to finish them off and avoid leaving lone triangles behind.
+		return score + valence_boost_scale * powf((float)remaining, -valence_boost_power);
+	}
+
+	// fifo post-transform cache simulation. vertices are stamped with the time they entered the cache,
+	// so the cache can be emptied in O(1) by moving time past every stamp.
+	class FifoCache {
+	public:
+		FifoCache(int nverts, int cache_size) : stamps_(nverts, 0), time_(cache_size + 1), cache_size_(cache_size) {}
+		void reset() { time_ += cache_size_ + 1; }
+		// misses of a triangle, loading missed vertices.
+		int add_triangle(const int *tri) {
+			int misses = 0;
+			for (int k = 0; k < 3; k++) {
+				if (time_ - stamps_[tri[k]] > cache_size_) {
+					stamps_[tri[k]] = time_++;
+					misses++;
+				}
+			}
+			return misses;
+		}
+	private:
+		std::vector<int> stamps_;
+		int time_;
+		int cache_size_;
+	};
+
+	Vec3f triangle_cross(const IndexedMesh &mesh, int face) {
+		const int *tri = &mesh.indices[face * 3];
+		const Vec3f &p0 = mesh.positions[tri[0]];
+		return cross(mesh.positions[tri[1]] - p0, mesh.positions[tri[2]] - p0);
+	}
+
+	Vec3f triangle_centroid(const IndexedMesh &mesh, int face) {
+		const int *tri = &mesh.indices[face * 3];
+		return (mesh.positions[tri[0]] + mesh.positions[tri[1]] + mesh.positions[tri[2]]) * (1.f / 3.f);
+	}
+
+	struct OverdrawCluster {
+		int begin;
+		int end;
+		float key;
+	};
+
+	// rasterize the triangles facing a viewer on the sign side of axis into the depth grid,
+	// counting fragments passing the depth test and pixels covered.
+	void rasterize_view(const int *indices, int nindices, const Vec3f *positions, int axis, float sign,
+		const Vec3f &box_min, float scale, std::vector<float> &depth, long long &shaded, long long &covered) {
+		const float empty = -std::numeric_limits<float>::max();
+		const int au = (axis + 1) % 3, av = (axis + 2) % 3;
+		std::fill(depth.begin(), depth.end(), empty);
+
+		for (int i = 0; i + 2 < nindices; i += 3) {
+			Vec3f p[3];
+			for (int k = 0; k < 3; k++) p[k] = positions[indices[i + k]];
+			if (cross(p[1] - p[0], p[2] - p[0]).raw[axis] * sign <= 0.f) continue;
+
+			float x[3], y[3], z[3];
+			for (int k = 0; k < 3; k++) {
+				x[k] = (p[k].raw[au] - box_min.raw[au]) * scale;
+				y[k] = (p[k].raw[av] - box_min.raw[av]) * scale;
+				z[k] = p[k].raw[axis] * sign;
+			}
+			float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+			if (area == 0.f) continue;
+			float inv_area = 1.f / area;
+
+			int min_x = std::max(0, (int)floorf(std::min(x[0], std::min(x[1], x[2]))));
+			int max_x = std::min(overdraw_grid_size - 1, (int)ceilf(std::max(x[0], std::max(x[1], x[2]))));
+			int min_y = std::max(0, (int)floorf(std::min(y[0], std::min(y[1], y[2]))));
+			int max_y = std::min(overdraw_grid_size - 1, (int)ceilf(std::max(y[0], std::max(y[1], y[2]))));
+			for (int py = min_y; py <= max_y; py++) {
+				for (int px = min_x; px <= max_x; px++) {
+					float cx = px + 0.5f, cy = py + 0.5f;
+					float b0 = ((x[1] - cx) * (y[2] - cy) - (x[2] - cx) * (y[1] - cy)) * inv_area;
+					float b1 = ((x[2] - cx) * (y[0] - cy) - (x[0] - cx) * (y[2] - cy)) * inv_area;
+					float b2 = 1.f - b0 - b1;
+					if (b0 < 0.f || b1 < 0.f || b2 < 0.f) continue;
+					float d = b0 * z[0] + b1 * z[1] + b2 * z[2];
+					float &pixel = depth[py * overdraw_grid_size + px];
+					if (d > pixel) {
+						if (pixel == empty) covered++;
+						pixel = d;
+						shaded++;
+					}
+				}
+			}
+		}
+	}
+}
+
+void optimize_vertex_cache(IndexedMesh &mesh, int cache_size) {
+	const int nfaces = mesh.nfaces();
+	const int nverts = mesh.nverts();
+	if (nfaces == 0) return;
+	const std::vector<int> &indices = mesh.indices;
+
+	// triangles using each vertex, adjacency[offsets[v] .. offsets[v]+remaining[v]) are the ones not emitted yet.
+	std::vector<int> remaining(nverts, 0);
+	for (int i = 0; i < nfaces * 3; i++) remaining[indices[i]]++;
+	std::vector<int> offsets(nverts + 1, 0);
+	for (int v = 0; v < nverts; v++) offsets[v + 1] = offsets[v] + remaining[v];
+	std::vector<int> adjacency(nfaces * 3);
+	std::vector<int> cursor(offsets.begin(), offsets.end() - 1);
+	for (int i = 0; i < nfaces * 3; i++) adjacency[cursor[indices[i]]++] = i / 3;
+
+	std::vector<float> vscore(nverts);
+	for (int v = 0; v < nverts; v++) vscore[v] = vertex_score(-1, remaining[v], cache_size);
+
+	std::vector<float> tscore(nfaces);
+	std::vector<char> emitted(nfaces, 0);
+	int best = 0;
+	for (int f = 0; f < nfaces; f++) {
+		tscore[f] = vscore[indices[f * 3]] + vscore[indices[f * 3 + 1]] + vscore[indices[f * 3 + 2]];
+		if (tscore[f] > tscore[best]) best = f;
+	}
+
+	// lru cache, most recent first. holds up to 3 extra vertices while a triangle is added.
+	std::vector<int> cache, new_cache;
+	cache.reserve(cache_size + 3);
+	new_cache.reserve(cache_size + 3);
+	std::vector<int> out;
+	out.reserve(nfaces * 3);
+	int input_cursor = 0;
+
+	for (int n = 0; n < nfaces; n++) {
+		if (best < 0) {
+			// nothing in the cache has triangles left, continue with the next triangle in input order.
+			while (emitted[input_cursor]) input_cursor++;
+			best = input_cursor;
+		}
+		emitted[best] = 1;
+		const int *tri = &indices[best * 3];
+		out.insert(out.end(), tri, tri + 3);
+
+		new_cache.clear();
+		for (int k = 0; k < 3; k++) {
+			if (std::find(new_cache.begin(), new_cache.end(), tri[k]) == new_cache.end()) new_cache.push_back(tri[k]);
+		}
+		for (size_t i = 0; i < cache.size(); i++) {
+			if (cache[i] != tri[0] && cache[i] != tri[1] && cache[i] != tri[2]) new_cache.push_back(cache[i]);
+		}
+
+		for (int k = 0; k < 3; k++) {
+			int v = tri[k];
+			int *list = &adjacency[offsets[v]];
+			for (int j = 0; j < remaining[v]; j++) {
+				if (list[j] == best) {
+					list[j] = list[--remaining[v]];
+					break;
+				}
+			}
+		}
+
+		// vertices pushed out of the cache get their no-cache score back.
+		for (size_t i = 0; i < new_cache.size(); i++) {
+			int v = new_cache[i];
+			vscore[v] = vertex_score((int)i < cache_size ? (int)i : -1, remaining[v], cache_size);
+		}
+
+		// only triangles of cached vertices changed score, the next triangle is the best of them.
+		best = -1;
+		float best_score = -1.f;
+		for (size_t i = 0; i < new_cache.size(); i++) {
+			int v = new_cache[i];
+			const int *list = &adjacency[offsets[v]];
+			for (int j = 0; j < remaining[v]; j++) {
+				int f = list[j];
+				tscore[f] = vscore[indices[f * 3]] + vscore[indices[f * 3 + 1]] + vscore[indices[f * 3 + 2]];
+				if (tscore[f] > best_score) {
+					best_score = tscore[f];
+					best = f;
+				}
+			}
+		}
+
+		if ((int)new_cache.size() > cache_size) new_cache.resize(cache_size);
+		cache.swap(new_cache);
+	}
+
+	mesh.indices.swap(out);
+}
+
+void optimize_overdraw(IndexedMesh &mesh, float threshold, int cache_size) {
+	const int nfaces = mesh.nfaces();
+	if (nfaces == 0) return;
+
+	const int *indices = mesh.indices.data();
+	FifoCache cache(mesh.nverts(), cache_size);
+	std::vector<int> misses(nfaces);
+	for (int f = 0; f < nfaces; f++) misses[f] = cache.add_triangle(indices + f * 3);
+
+	// hard boundaries where the cache starts from scratch anyway (a triangle with 3 misses).
+	// inside a hard cluster, a soft boundary goes after the first run of triangles whose acmr, drawn with an empty
+	// cache, is within threshold of the whole cluster's. every cluster pays for starting cold, so splitting
+	// this way keeps the acmr of the reordered mesh within about threshold of the cache optimized one.
+	std::vector<OverdrawCluster> clusters;
+	for (int begin = 0; begin < nfaces; ) {
+		int end = begin + 1;
+		while (end < nfaces && misses[end] < 3) end++;
+
+		int cluster_misses = 0;
+		cache.reset();
+		for (int f = begin; f < end; f++) cluster_misses += cache.add_triangle(indices + f * 3);
+		float limit = threshold * cluster_misses / (end - begin);
+
+		int start = begin, run_misses = 0;
+		cache.reset();
+		for (int f = begin; f < end; f++) {
+			run_misses += cache.add_triangle(indices + f * 3);
+			if (f + 1 < end && run_misses <= limit * (f - start + 1)) {
+				OverdrawCluster cluster = { start, f + 1, 0.f };
+				clusters.push_back(cluster);
+				start = f + 1;
+				run_misses = 0;
+				cache.reset();
+			}
+		}
+		OverdrawCluster cluster = { start, end, 0.f };
+		clusters.push_back(cluster);
+		begin = end;
+	}
+
+	// area weighted center of the mesh.
+	Vec3f mesh_center;
+	float mesh_area = 0.f;
+	for (int f = 0; f < nfaces; f++) {
+		float area = triangle_cross(mesh, f).norm();
+		mesh_center = mesh_center + triangle_centroid(mesh, f) * area;
+		mesh_area += area;
+	}
+	if (mesh_area > 0.f) mesh_center = mesh_center * (1.f / mesh_area);
+
+	// clusters facing outwards and far from the center occlude the others from most views, draw them first.
+	for (size_t c = 0; c < clusters.size(); c++) {
+		Vec3f center, normal;
+		float area = 0.f;
+		for (int f = clusters[c].begin; f < clusters[c].end; f++) {
+			Vec3f n = triangle_cross(mesh, f);
+			float a = n.norm();
+			center = center + triangle_centroid(mesh, f) * a;
+			normal = normal + n;
+			area += a;
+		}
+		float length = normal.norm();
+		clusters[c].key = (area > 0.f && length > 0.f) ? ((center * (1.f / area) - mesh_center) * normal) / length : 0.f;
+	}
+	std::stable_sort(clusters.begin(), clusters.end(), [](const OverdrawCluster &a, const OverdrawCluster &b) { return a.key > b.key; });
+
+	std::vector<int> out;
+	out.reserve(mesh.indices.size());
+	for (size_t c = 0; c < clusters.size(); c++) {
+		out.insert(out.end(), mesh.indices.begin() + clusters[c].begin * 3, mesh.indices.begin() + clusters[c].end * 3);
+	}
+
+	// the sort is a guess, it can draw a mesh with many concave parts worse than before. the new order is only kept
+	// when it measurably lowers overdraw and its acmr stays within threshold of the input's.
+	const int nindices = (int)out.size();
+	const float acmr_in = analyze_acmr(mesh.indices.data(), nindices, mesh.nverts(), cache_size);
+	const float acmr_out = analyze_acmr(out.data(), nindices, mesh.nverts(), cache_size);
+	if (acmr_out > threshold * acmr_in) return;
+	const float overdraw_in = analyze_overdraw(mesh.indices.data(), nindices, mesh.positions.data(), mesh.nverts());
+	const float overdraw_out = analyze_overdraw(out.data(), nindices, mesh.positions.data(), mesh.nverts());
+	if (overdraw_out >= overdraw_in) return;
+	mesh.indices.swap(out);
+}
+
+void optimize_vertex_fetch(IndexedMesh &mesh) {
+	const int nverts = mesh.nverts();
+	std::vector<int> remap(nverts, -1);
+	int next = 0;
+	for (size_t i = 0; i < mesh.indices.size(); i++) {
+		int &v = mesh.indices[i];
+		if (remap[v] < 0) remap[v] = next++;
+		v = remap[v];
+	}
+	// unused vertices keep their relative order at the end.
+	for (int v = 0; v < nverts; v++) {
+		if (remap[v] < 0) remap[v] = next++;
+	}
+
+	std::vector<Vec3f> positions(nverts), normals(nverts);
+	std::vector<Vec2f> uvs(nverts);
+	for (int v = 0; v < nverts; v++) {
+		positions[remap[v]] = mesh.positions[v];
+		uvs[remap[v]] = mesh.uvs[v];
+		normals[remap[v]] = mesh.normals[v];
+	}
+	mesh.positions.swap(positions);
+	mesh.uvs.swap(uvs);
+	mesh.normals.swap(normals);
+}
+
+void optimize_mesh(IndexedMesh &mesh, unsigned flags) {
+	if (flags & MESH_OPTIMIZE_VERTEX_CACHE) optimize_vertex_cache(mesh);
+	if (flags & MESH_OPTIMIZE_OVERDRAW) optimize_overdraw(mesh);
+	if (flags & MESH_OPTIMIZE_VERTEX_FETCH) optimize_vertex_fetch(mesh);
+}
+
+float analyze_acmr(const int *indices, int nindices, int nverts, int cache_size) {
+	if (nindices < 3) return 0.f;
+	FifoCache cache(nverts, cache_size);
+	long long misses = 0;
+	for (int i = 0; i + 2 < nindices; i += 3) misses += cache.add_triangle(indices + i);
+	return (float)misses / (nindices / 3);
+}
+
+float analyze_overdraw(const int *indices, int nindices, const Vec3f *positions, int nverts) {
+	if (nverts == 0 || nindices < 3) return 0.f;
+	Vec3f box_min = positions[0], box_max = positions[0];
+	for (int v = 1; v < nverts; v++) {
+		for (int k = 0; k < 3; k++) {
+			box_min.raw[k] = std::min(box_min.raw[k], positions[v].raw[k]);
+			box_max.raw[k] = std::max(box_max.raw[k], positions[v].raw[k]);
+		}
+	}
+	float extent = std::max(box_max.x - box_min.x, std::max(box_max.y - box_min.y, box_max.z - box_min.z));
+	if (extent <= 0.f) return 0.f;
+	float scale = (overdraw_grid_size - 1) / extent;
+
+	std::vector<float> depth(overdraw_grid_size * overdraw_grid_size);
+	long long shaded = 0, covered = 0;
+	for (int axis = 0; axis < 3; axis++) {
+		rasterize_view(indices, nindices, positions, axis, 1.f, box_min, scale, depth, shaded, covered);
+		rasterize_view(indices, nindices, positions, axis, -1.f, box_min, scale, depth, shaded, covered);
+	}
+	return covered ? (float)shaded / covered : 0.f;
+}
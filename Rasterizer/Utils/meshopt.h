@@ -0,0 +1,36 @@
+#ifndef __MESHOPT_H__
+#define __MESHOPT_H__
+
+#include "objparser.h"
+
+// One-time optimization of an IndexedMesh after loading. none of them changes what is drawn, only the order:
+// triangles for post-transform vertex cache hits and less overdraw, vertices for fetching memory in order.
+enum MeshOptimizeFlags {
+	MESH_OPTIMIZE_NONE = 0,
+	MESH_OPTIMIZE_VERTEX_CACHE = 1, // reorder triangles (Forsyth "linear-speed vertex cache optimisation")
+	MESH_OPTIMIZE_OVERDRAW = 2, // then sort clusters of triangles to be drawn roughly front to back from any view
+	MESH_OPTIMIZE_VERTEX_FETCH = 4, // last, renumber vertices in order of first use
+	MESH_OPTIMIZE_ALL = 7
+};
+
+const int mesh_optimize_cache_size = 32;
+
+// reorder triangles so consecutive triangles share vertices, tuned for a fifo/lru cache of cache_size vertices.
+void optimize_vertex_cache(IndexedMesh &mesh, int cache_size = mesh_optimize_cache_size);
+// split the (cache optimized) triangle order into clusters at cache misses and sort the clusters so outward facing
+// ones come first, which is front to back for most views. a cluster is only split where its own acmr stays
+// below threshold * acmr of the surrounding run of triangles, so the vertex cache order is mostly kept.
+// the input order is kept when the sorted one doesn't lower analyze_overdraw or raises acmr above threshold * the input's.
+void optimize_overdraw(IndexedMesh &mesh, float threshold = 1.05f, int cache_size = mesh_optimize_cache_size);
+// renumber vertices in order of first use in indices and reorder the vertex streams to match.
+void optimize_vertex_fetch(IndexedMesh &mesh);
+// apply the passes selected by flags (MeshOptimizeFlags) in the order above.
+void optimize_mesh(IndexedMesh &mesh, unsigned flags);
+
+// average cache miss ratio: vertices transformed per triangle with a fifo post-transform cache of cache_size.
+float analyze_acmr(const int *indices, int nindices, int nverts, int cache_size = mesh_optimize_cache_size);
+// overdraw: fragments passing the depth test / pixels covered, averaged over 6 axis aligned orthographic views
+// (back faces culled, triangles drawn in index order). 1 means every covered pixel is shaded once.
+float analyze_overdraw(const int *indices, int nindices, const Vec3f *positions, int nverts);
+
+#endif //__MESHOPT_H__
@@ -1,16 +1,24 @@
 #include <iostream>
 #include <string>
-#include <fstream>
-#include <sstream>
 #include <vector>
 #include "model.h"
+#include "objparser.h"
+#include "meshcache.h"
+#include "meshopt.h"
+
+namespace {
+	// texture file next to the obj, with the obj's extension replaced by suffix. empty if filename has no extension.
+	std::string texture_filename(const std::string &filename, const char *suffix) {
+		size_t dot = filename.find_last_of(".");
+		if (dot == std::string::npos) return std::string();
+		return filename.substr(0, dot) + std::string(suffix);
+	}
+}
 
 void Model::load_texture(std::string filename, const char *suffix, TGAImage &img)
 {
-	std::string texfile(filename);
-	size_t dot = texfile.find_last_of(".");
-	if (dot != std::string::npos) {
-		texfile = texfile.substr(0, dot) + std::string(suffix);
+	std::string texfile = texture_filename(filename, suffix);
+	if (!texfile.empty()) {
 		std::cerr << "texture file " << texfile << " loading " << (img.read_tga_file(texfile.c_str()) ? "ok" : "failed") << std::endl;
 		img.flip_vertically();
 	}
@@ -22,111 +30,178 @@ void Model::load_texture(std::string filename, TGAImage &img)
 	img.flip_vertically();
 }
 
-Model::Model(const char *filename) : verts_(), faces_() {
-	std::ifstream in;
-	in.open(filename, std::ifstream::in);
-	if (in.fail()) return;
-	std::string line;
-	while (!in.eof()) {
-		std::getline(in, line);
-		std::istringstream iss(line.c_str());
-		char trash;
-		if (!line.compare(0, 2, "v ")) {
-			iss >> trash;
-			Vec3f v;
-			for (int i = 0; i < 3; i++) iss >> v.raw[i];
-			verts_.push_back(v);
-		}
-		else if (!line.compare(0, 3, "vt ")) {
-			iss >> trash >> trash;
-			Vec2f uv;
-			for (int i = 0; i < 2; i++) iss >> uv.raw[i];
-			uv_.push_back(uv);
+Model::Model(const char *filename, bool use_cache, unsigned optimize_flags, TextureLayout mapped_layout) : verts_(), indices_() {
+	const char *suffixes[] = { "_diffuse.tga", "_nm.tga", "_spec.tga" };
+	//const char *suffixes[] = { "_diffuse.tga", "_nm_tangent.tga", "_spec.tga" };
+	const int ntextures = 3;
+	Texture *maps[] = { &diffusemap_, &normalmap_, &specularmap_ };
+	// images only live until their mip chains are built.
+	TGAImage images[ntextures];
+	TGAImage *textures[] = { &images[0], &images[1], &images[2] };
+	std::string texfiles[ntextures];
+	const char *texnames[ntextures];
+	for (int i = 0; i < ntextures; i++) {
+		texfiles[i] = texture_filename(filename, suffixes[i]);
+		texnames[i] = texfiles[i].c_str();
+		// uncompressed textures come straight from the file mapping and are not cached, only rle ones go through images.
+		if (!texfiles[i].empty() && maps[i]->map(texnames[i], mapped_layout)) {
+			std::cerr << "texture file " << texfiles[i] << " mapping ok" << std::endl;
+			textures[i] = NULL;
 		}
-		else if (!line.compare(0, 3, "vn ")) {
-			iss >> trash >> trash;
-			Vec3f n;
-			for (int i = 0; i < 3; i++) iss >> n.raw[i];
-			norms_.push_back(n);
+	}
+
+	IndexedMesh mesh;
+	if (use_cache && read_mesh_cache(filename, texnames, ntextures, optimize_flags, mesh, textures)) {
+		std::cerr << "mesh cache " << mesh_cache_filename(filename) << " loading ok" << std::endl;
+	}
+	else {
+		ObjData obj;
+		if (!load_obj(filename, obj)) return;
+		build_indexed_mesh(obj, mesh);
+		optimize_mesh(mesh, optimize_flags);
+		for (int i = 0; i < ntextures; i++) {
+			if (textures[i]) load_texture(filename, suffixes[i], *textures[i]);
 		}
-		else if (!line.compare(0, 2, "f ")) {
-			std::vector<Vec3i> f;
-			Vec3i tmp;
-			iss >> trash;
-			while (iss >> tmp.raw[0] >> trash >> tmp.raw[1] >> trash >> tmp.raw[2]) {
-				for (int i = 0; i<3; i++) tmp.raw[i]--; // in wavefront obj all indices start at 1, not zero
-				f.push_back(tmp);
-			}
-			faces_.push_back(f);
+		// using grid texture.
+		//load_texture("F:\\workdir\\personal\\Rasterizer\\Resource\\grid.tga", images[0]);
+
+		if (use_cache && !write_mesh_cache(filename, texnames, ntextures, optimize_flags, mesh, textures)) {
+			std::cerr << "mesh cache " << mesh_cache_filename(filename) << " writing failed" << std::endl;
 		}
 	}
-	std::cerr << "# v# " << verts_.size() << " f# " << faces_.size() << std::endl;
 
-	load_texture(filename, "_diffuse.tga", diffusemap_);
+	for (int i = 0; i < ntextures; i++) {
+		if (textures[i]) maps[i]->build(images[i]);
+	}
 
-	// using grid texture.
-	//load_texture("F:\\workdir\\personal\\Rasterizer\\Resource\\grid.tga", diffusemap_);
-	load_texture(filename, "_nm.tga", normalmap_);
-	//load_texture(filename, "_nm_tangent.tga", normalmap_);
-	load_texture(filename, "_spec.tga", specularmap_);
+	verts_.swap(mesh.positions);
+	uv_.swap(mesh.uvs);
+	norms_.swap(mesh.normals);
+	indices_.swap(mesh.indices);
+	// normalized once here, so norm() never writes and the model can be shared by concurrent renders.
+	for (size_t i = 0; i < norms_.size(); i++) norms_[i].normalize();
+	std::cerr << "# v# " << verts_.size() << " f# " << nfaces() << std::endl;
 }
 
 Model::~Model() {
 }
 
-int Model::nverts() {
+int Model::nverts() const {
 	return (int)verts_.size();
 }
 
-int Model::nfaces() {
-	return (int)faces_.size();
+int Model::nfaces() const {
+	return (int)indices_.size() / 3;
+}
+
+Span<int> Model::face(int idx) const {
+	return Span<int>(&indices_[idx * 3], 3);
 }
 
-std::vector<int> Model::face(int idx) {
-	std::vector<int> face;
-	for (int i = 0; i < (int)faces_[idx].size(); i++) face.push_back(faces_[idx][i].raw[0]);
-	return face;
+int Model::vert_index(int iface, int nthvert) const {
+	return indices_[iface * 3 + nthvert];
 }
 
-Vec3f Model::vert(int i) {
+Vec3f Model::vert(int i) const {
 	return verts_[i];
 }
 
-Vec3f Model::vert(int iface, int nthvert)
-{
-	return verts_[faces_[iface][nthvert].raw[0]];
+Vec2f Model::uv(int i) const {
+	return uv_[i];
 }
 
-Vec2f Model::uv(int iface, int nthvert)
+Vec3f Model::norm(int i) const {
+	return norms_[i];
+}
+
+Vec3f Model::vert(int iface, int nthvert) const
 {
-	return uv_[faces_[iface][nthvert].raw[1]];
+	return verts_[indices_[iface * 3 + nthvert]];
 }
 
-Vec3f Model::norm(int iface, int nthvert)
+Vec2f Model::uv(int iface, int nthvert) const
 {
-	return norms_[faces_[iface][nthvert].raw[2]].normalize();
+	return uv_[indices_[iface * 3 + nthvert]];
 }
 
-Vec3f Model::normal(Vec2f uvf) 
+Vec3f Model::norm(int iface, int nthvert) const
 {
-	Vec2i uv(uvf.x * normalmap_.get_width(), uvf.y * normalmap_.get_height());
-	TGAColor c = normalmap_.get(uv.x, uv.y);
-	Vec3f res;
-	for (int i = 0; i < 3; i++)
-	{
-		res.raw[2 - i] = (float)c.bgra[i] / 255.f*2.f - 1.f;
+	return norms_[indices_[iface * 3 + nthvert]];
+}
+
+Span<Vec3f> Model::verts() const {
+	return Span<Vec3f>(verts_.data(), (int)verts_.size());
+}
+
+Span<Vec2f> Model::uvs() const {
+	return Span<Vec2f>(uv_.data(), (int)uv_.size());
+}
+
+Span<Vec3f> Model::norms() const {
+	return Span<Vec3f>(norms_.data(), (int)norms_.size());
+}
+
+Span<int> Model::indices() const {
+	return Span<int>(indices_.data(), (int)indices_.size());
+}
+
+namespace {
+	Vec3f to_normal(const TGAColor &c) {
+		Vec3f res;
+		for (int i = 0; i < 3; i++)
+		{
+			res.raw[2 - i] = (float)c.bgra[i] / 255.f*2.f - 1.f;
+		}
+		return res;
 	}
+}
 
-	return res;
+Vec3f Model::normal(Vec2f uvf) 
+{
+	return to_normal(normalmap_.sample_nearest(uvf));
 }
 
 TGAColor Model::diffuse(Vec2f uvf)
 {
-	Vec2i uv(uvf.raw[0] * diffusemap_.get_width(), uvf.raw[1] * diffusemap_.get_height());
-	return diffusemap_.get(uv.raw[0], uv.raw[1]);
+	return diffusemap_.sample_nearest(uvf);
 }
 
 float Model::specular(Vec2f uvf) {
-	Vec2i uv(uvf.raw[0] * specularmap_.get_width(), uvf.raw[1] * specularmap_.get_height());
-	return specularmap_.get(uv.raw[0], uv.raw[1]).bgra[0] / 1.f;
+	return specularmap_.sample_nearest(uvf).bgra[0] / 1.f;
+}
+
+Vec3f Model::normal(Vec2f uvf, const Vec2f &duvdx, const Vec2f &duvdy) const
+{
+	return to_normal(normalmap_.sample(uvf, duvdx, duvdy));
+}
+
+TGAColor Model::diffuse(Vec2f uvf, const Vec2f &duvdx, const Vec2f &duvdy) const
+{
+	return diffusemap_.sample(uvf, duvdx, duvdy);
+}
+
+float Model::specular(Vec2f uvf, const Vec2f &duvdx, const Vec2f &duvdy) const {
+	return specularmap_.sample(uvf, duvdx, duvdy).bgra[0] / 1.f;
+}
+
+void Model::set_texture_filter(TextureFilter filter) {
+	diffusemap_.set_filter(filter);
+	normalmap_.set_filter(filter);
+	specularmap_.set_filter(filter);
+}
+
+TextureFilter Model::texture_filter() const {
+	return diffusemap_.filter();
+}
+
+const Texture &Model::diffusemap() const {
+	return diffusemap_;
+}
+
+const Texture &Model::normalmap() const {
+	return normalmap_;
+}
+
+const Texture &Model::specularmap() const {
+	return specularmap_;
 }
@@ -1,37 +1,81 @@
 #ifndef __MODEL_H__
 #define __MODEL_H__
 
+#include <stddef.h>
+#include <string>
 #include <vector>
 #include "geometry.h"
+#include "texture.h"
 #include "tgaimage.h"
 
+// read only view of count contiguous elements owned by somebody else, like std::span.
+template <class t> struct Span {
+	const t *ptr;
+	int count;
+
+	Span() : ptr(NULL), count(0) {}
+	Span(const t *p, int n) : ptr(p), count(n) {}
+	int size() const { return count; }
+	const t *data() const { return ptr; }
+	const t &operator [](int i) const { return ptr[i]; }
+	const t *begin() const { return ptr; }
+	const t *end() const { return ptr + count; }
+};
+
+// Triangle mesh with unified vertices: position, uv and normal streams are indexed by the same vertex index,
+// faces are 3 consecutive entries of one index array. nothing is allocated when fetching a face or a vertex.
 class Model 
 {
 public:
-	Model(const char *filename);
+	// use_cache: load from / write to the binary mesh cache next to the obj (see meshcache.h).
+	// optimize_flags: MeshOptimizeFlags passes run on the mesh after parsing (see meshopt.h).
+	// mapped_layout: layout of the textures mapped from uncompressed tga files (see Texture::map). linear reads
+	// level 0 in place from the mapping, tiled copies it to the heap for faster fetches. rle textures are always tiled.
+	Model(const char *filename, bool use_cache = true, unsigned optimize_flags = 0, TextureLayout mapped_layout = TEXTURE_LAYOUT_LINEAR);
 	~Model();
-	int nverts();
-	int nfaces();
-	Vec3f vert(int i);
-	Vec3f vert(int iface, int nthvert);
-	Vec2f uv(int iface, int nthvert);
-	Vec3f norm(int iface, int nthvert);
+	int nverts() const;
+	int nfaces() const;
+	Vec3f vert(int i) const;
+	Vec2f uv(int i) const;
+	Vec3f norm(int i) const;
+	Vec3f vert(int iface, int nthvert) const;
+	Vec2f uv(int iface, int nthvert) const;
+	Vec3f norm(int iface, int nthvert) const;
+	// texel of level 0 the uv falls in.
 	Vec3f normal(Vec2f uvf);
 	TGAColor diffuse(Vec2f uvf);
 	float specular(Vec2f uvf);
-	std::vector<int> face(int idx);
+	// filtered with the texture filter, duvdx/duvdy are the uv derivatives along screen x and y.
+	Vec3f normal(Vec2f uvf, const Vec2f &duvdx, const Vec2f &duvdy) const;
+	TGAColor diffuse(Vec2f uvf, const Vec2f &duvdx, const Vec2f &duvdy) const;
+	float specular(Vec2f uvf, const Vec2f &duvdx, const Vec2f &duvdy) const;
+	void set_texture_filter(TextureFilter filter);
+	TextureFilter texture_filter() const;
+	const Texture &diffusemap() const;
+	const Texture &normalmap() const;
+	const Texture &specularmap() const;
+	// vertex indices of face idx.
+	Span<int> face(int idx) const;
+	int vert_index(int iface, int nthvert) const;
+
+	// whole streams, indexed by vertex index.
+	Span<Vec3f> verts() const;
+	Span<Vec2f> uvs() const;
+	Span<Vec3f> norms() const;
+	// 3 vertex indices per face.
+	Span<int> indices() const;
 
 private:
 	std::vector<Vec3f> verts_;
-	std::vector<std::vector<Vec3i> > faces_; // one face is Vec3i---vertex/uv/normal
 	std::vector<Vec2f> uv_;
 	std::vector<Vec3f> norms_;
-	TGAImage diffusemap_;
-	TGAImage normalmap_;
-	TGAImage specularmap_;
+	std::vector<int> indices_;
+	Texture diffusemap_;
+	Texture normalmap_;
+	Texture specularmap_;
 
 	void load_texture(std::string filename, const char *suffix, TGAImage &img);
 	void load_texture(std::string filename, TGAImage &img);
 };
 
-#endif //__MODEL_H__
\ No newline at end of file
+#endif //__MODEL_H__
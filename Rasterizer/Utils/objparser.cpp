@@ -0,0 +1,306 @@
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <unordered_map>
+#include "objparser.h"
+#include "mappedfile.h"
+
+namespace {
+	// smallest chunk worth a thread of its own.
+	const size_t min_chunk_size = 1 << 20;
+
+	// exact powers of ten in float, 10^10 still fits the 24 bit mantissa.
+	const float pow10f[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+
+	inline bool is_blank(char c) {
+		return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+	}
+
+	inline bool is_digit(char c) {
+		return c >= '0' && c <= '9';
+	}
+
+	inline const char *skip_blank(const char *p, const char *end) {
+		while (p < end && is_blank(*p)) p++;
+		return p;
+	}
+
+	// same value as `stream >> float`: the result is always correctly rounded.
+	// numbers with up to 8 significant digits and a small exponent (all numbers in usual obj files) take the fast path,
+	// one exact float multiply/divide of two exact values. anything else is handed to strtof.
+	bool scan_float(const char *&p, const char *end, float &out) {
+		p = skip_blank(p, end);
+		const char *start = p;
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+')) {
+			negative = *p == '-';
+			p++;
+		}
+
+		unsigned long long mantissa = 0;
+		int ndigits = 0; // significant digits in mantissa
+		int exponent = 0;
+		bool any_digit = false;
+		for (; p < end && is_digit(*p); p++) {
+			any_digit = true;
+			if (mantissa == 0 && *p == '0') continue;
+			if (ndigits < 19) {
+				mantissa = mantissa * 10 + (*p - '0');
+				ndigits++;
+			}
+			else {
+				exponent++;
+			}
+		}
+		if (p < end && *p == '.') {
+			for (p++; p < end && is_digit(*p); p++) {
+				any_digit = true;
+				if (mantissa == 0 && *p == '0') {
+					exponent--;
+					continue;
+				}
+				if (ndigits < 19) {
+					mantissa = mantissa * 10 + (*p - '0');
+					ndigits++;
+					exponent--;
+				}
+			}
+		}
+		if (!any_digit) {
+			p = start;
+			return false;
+		}
+		if (p < end && (*p == 'e' || *p == 'E')) {
+			const char *q = p + 1;
+			bool negative_exp = false;
+			if (q < end && (*q == '-' || *q == '+')) {
+				negative_exp = *q == '-';
+				q++;
+			}
+			if (q < end && is_digit(*q)) {
+				int e = 0;
+				for (; q < end && is_digit(*q); q++) {
+					if (e < 10000) e = e * 10 + (*q - '0');
+				}
+				exponent += negative_exp ? -e : e;
+				p = q;
+			}
+		}
+
+		if (mantissa <= (1u << 24) && exponent >= -10 && exponent <= 10) {
+			float value = (float)mantissa;
+			value = exponent < 0 ? value / pow10f[-exponent] : value * pow10f[exponent];
+			out = negative ? -value : value;
+			return true;
+		}
+
+		// slow path, mapped text is not null terminated.
+		char buffer[128];
+		size_t length = std::min((size_t)(p - start), sizeof(buffer) - 1);
+		memcpy(buffer, start, length);
+		buffer[length] = '\0';
+		out = strtof(buffer, NULL);
+		return true;
+	}
+
+	bool scan_int(const char *&p, const char *end, int &out) {
+		p = skip_blank(p, end);
+		const char *start = p;
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+')) {
+			negative = *p == '-';
+			p++;
+		}
+		if (p >= end || !is_digit(*p)) {
+			p = start;
+			return false;
+		}
+		int value = 0;
+		for (; p < end && is_digit(*p); p++) value = value * 10 + (*p - '0');
+		out = negative ? -value : value;
+		return true;
+	}
+
+	// skip one separator character like `stream >> char` does.
+	bool scan_char(const char *&p, const char *end) {
+		p = skip_blank(p, end);
+		if (p >= end || *p == '\n') return false;
+		p++;
+		return true;
+	}
+
+	inline bool starts_with(const char *p, const char *end, const char *prefix, size_t length) {
+		return (size_t)(end - p) >= length && !memcmp(p, prefix, length);
+	}
+
+	// parse all lines in [p, end), end is at a line boundary.
+	void parse_chunk(const char *p, const char *end, ObjData &out) {
+		while (p < end) {
+			const char *line_end = (const char *)memchr(p, '\n', end - p);
+			if (!line_end) line_end = end;
+
+			if (starts_with(p, line_end, "v ", 2)) {
+				p += 2;
+				Vec3f v;
+				for (int i = 0; i < 3 && scan_float(p, line_end, v.raw[i]); i++);
+				out.verts.push_back(v);
+			}
+			else if (starts_with(p, line_end, "vt ", 3)) {
+				p += 3;
+				Vec2f uv;
+				for (int i = 0; i < 2 && scan_float(p, line_end, uv.raw[i]); i++);
+				out.uvs.push_back(uv);
+			}
+			else if (starts_with(p, line_end, "vn ", 3)) {
+				p += 3;
+				Vec3f n;
+				for (int i = 0; i < 3 && scan_float(p, line_end, n.raw[i]); i++);
+				out.norms.push_back(n);
+			}
+			else if (starts_with(p, line_end, "f ", 2)) {
+				p += 2;
+				Vec3i corner;
+				while (scan_int(p, line_end, corner.raw[0]) && scan_char(p, line_end) &&
+					scan_int(p, line_end, corner.raw[1]) && scan_char(p, line_end) &&
+					scan_int(p, line_end, corner.raw[2])) {
+					for (int i = 0; i < 3; i++) corner.raw[i]--; // in wavefront obj all indices start at 1, not zero
+					out.face_corners.push_back(corner);
+				}
+				out.face_starts.push_back((int)out.face_corners.size());
+			}
+			p = line_end + 1;
+		}
+	}
+
+	struct CornerHash {
+		size_t operator()(const Vec3i &c) const {
+			return ((size_t)(unsigned)c.raw[0] * 73856093u) ^ ((size_t)(unsigned)c.raw[1] * 19349663u) ^ ((size_t)(unsigned)c.raw[2] * 83492791u);
+		}
+	};
+
+	struct CornerEqual {
+		bool operator()(const Vec3i &a, const Vec3i &b) const {
+			return a.raw[0] == b.raw[0] && a.raw[1] == b.raw[1] && a.raw[2] == b.raw[2];
+		}
+	};
+
+	template <class T> T element_or_zero(const std::vector<T> &v, int i) {
+		return i >= 0 && i < (int)v.size() ? v[i] : T();
+	}
+
+	template <class T> void append(std::vector<T> &to, const std::vector<T> &from) {
+		to.insert(to.end(), from.begin(), from.end());
+	}
+}
+
+void ObjData::clear() {
+	verts.clear();
+	uvs.clear();
+	norms.clear();
+	face_corners.clear();
+	face_starts.clear();
+}
+
+void IndexedMesh::clear() {
+	positions.clear();
+	uvs.clear();
+	normals.clear();
+	indices.clear();
+}
+
+void build_indexed_mesh(const ObjData &obj, IndexedMesh &out) {
+	out.clear();
+	out.indices.reserve(obj.face_corners.size());
+
+	std::unordered_map<Vec3i, int, CornerHash, CornerEqual> unified;
+	unified.reserve(obj.verts.size() * 2);
+	std::vector<int> face;
+	for (int f = 0; f < obj.nfaces(); f++) {
+		face.clear();
+		for (int c = obj.face_starts[f]; c < obj.face_starts[f + 1]; c++) {
+			const Vec3i &corner = obj.face_corners[c];
+			std::pair<std::unordered_map<Vec3i, int, CornerHash, CornerEqual>::iterator, bool> found = unified.insert(std::make_pair(corner, out.nverts()));
+			if (found.second) {
+				out.positions.push_back(element_or_zero(obj.verts, corner.raw[0]));
+				out.uvs.push_back(element_or_zero(obj.uvs, corner.raw[1]));
+				out.normals.push_back(element_or_zero(obj.norms, corner.raw[2]));
+			}
+			face.push_back(found.first->second);
+		}
+		for (int c = 2; c < (int)face.size(); c++) {
+			out.indices.push_back(face[0]);
+			out.indices.push_back(face[c - 1]);
+			out.indices.push_back(face[c]);
+		}
+	}
+}
+
+void parse_obj(const char *text, size_t size, ObjData &out, int nthreads) {
+	out.clear();
+	out.face_starts.push_back(0);
+
+	if (nthreads <= 0) {
+		nthreads = std::max(1, (int)std::thread::hardware_concurrency());
+	}
+	size_t nchunks = std::max<size_t>(1, std::min<size_t>(nthreads, size / min_chunk_size));
+
+	// chunk boundaries just after a '\n'.
+	std::vector<const char *> bounds(1, text);
+	for (size_t i = 1; i < nchunks; i++) {
+		const char *split = std::max(text + size * i / nchunks, bounds.back());
+		const char *newline = (const char *)memchr(split, '\n', text + size - split);
+		bounds.push_back(newline ? newline + 1 : text + size);
+	}
+	bounds.push_back(text + size);
+
+	if (nchunks == 1) {
+		parse_chunk(text, text + size, out);
+		return;
+	}
+
+	// face_starts of a chunk are relative to the chunk's own corners, fixed up when merged.
+	std::vector<ObjData> chunks(nchunks);
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < nchunks; i++) {
+		threads.emplace_back(parse_chunk, bounds[i], bounds[i + 1], std::ref(chunks[i]));
+	}
+	parse_chunk(bounds[0], bounds[1], chunks[0]);
+	for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+
+	size_t nverts = 0, nuvs = 0, nnorms = 0, ncorners = 0, nfaces = 0;
+	for (size_t i = 0; i < nchunks; i++) {
+		nverts += chunks[i].verts.size();
+		nuvs += chunks[i].uvs.size();
+		nnorms += chunks[i].norms.size();
+		ncorners += chunks[i].face_corners.size();
+		nfaces += chunks[i].face_starts.size();
+	}
+	out.verts.reserve(nverts);
+	out.uvs.reserve(nuvs);
+	out.norms.reserve(nnorms);
+	out.face_corners.reserve(ncorners);
+	out.face_starts.reserve(nfaces + 1);
+
+	for (size_t i = 0; i < nchunks; i++) {
+		int corner_offset = (int)out.face_corners.size();
+		append(out.verts, chunks[i].verts);
+		append(out.uvs, chunks[i].uvs);
+		append(out.norms, chunks[i].norms);
+		append(out.face_corners, chunks[i].face_corners);
+		for (size_t f = 0; f < chunks[i].face_starts.size(); f++) {
+			out.face_starts.push_back(chunks[i].face_starts[f] + corner_offset);
+		}
+	}
+}
+
+bool load_obj(const char *filename, ObjData &out, int nthreads) {
+	MappedFile file;
+	if (!file.open(filename)) {
+		out.clear();
+		return false;
+	}
+	parse_obj(file.data(), file.size(), out, nthreads);
+	return true;
+}
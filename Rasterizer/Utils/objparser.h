@@ -0,0 +1,48 @@
+#ifndef __OBJPARSER_H__
+#define __OBJPARSER_H__
+
+#include <stddef.h>
+#include <vector>
+#include "geometry.h"
+
+// raw arrays of a wavefront obj file, in file order.
+// faces are stored flat: corners of face i are face_corners[face_starts[i]] .. face_corners[face_starts[i+1]-1],
+// one corner is Vec3i---vertex/uv/normal index, starting at zero.
+struct ObjData {
+	std::vector<Vec3f> verts;
+	std::vector<Vec2f> uvs;
+	std::vector<Vec3f> norms;
+	std::vector<Vec3i> face_corners;
+	std::vector<int> face_starts; // nfaces+1 entries
+
+	int nfaces() const { return face_starts.empty() ? 0 : (int)face_starts.size() - 1; }
+	void clear();
+};
+
+// obj faces as triangles over unified vertices, one vertex for every distinct vertex/uv/normal index triple of the obj.
+// the vertex streams are all indexed by the same number, triangle i is indices[3*i] .. indices[3*i+2].
+struct IndexedMesh {
+	std::vector<Vec3f> positions;
+	std::vector<Vec2f> uvs;
+	std::vector<Vec3f> normals;
+	std::vector<int> indices;
+
+	int nverts() const { return (int)positions.size(); }
+	int nfaces() const { return (int)indices.size() / 3; }
+	void clear();
+};
+
+// deduplicate corners of obj into unified vertices, in order of first use.
+// polygons are split into a triangle fan, faces with less than 3 corners are dropped.
+// a missing or out of range uv/normal index gives a zero uv/normal.
+void build_indexed_mesh(const ObjData &obj, IndexedMesh &out);
+
+// parse obj text in memory: "v ", "vt ", "vn " and "f v/t/n ..." lines, everything else is skipped.
+// text is split into chunks at line boundaries which are parsed in parallel and appended in order,
+// so the result is the same for any number of threads. nthreads <= 0 means one thread per hardware core.
+void parse_obj(const char *text, size_t size, ObjData &out, int nthreads = 0);
+
+// memory map filename and parse it, false if the file can't be opened.
+bool load_obj(const char *filename, ObjData &out, int nthreads = 0);
+
+#endif //__OBJPARSER_H__
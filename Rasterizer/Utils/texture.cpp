@@ -0,0 +1,237 @@
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+#include "texture.h"
+
+namespace {
+	// bits 0..2 of v spread to bits 0, 2 and 4.
+	inline int spread_bits(int v) {
+		return (v & 1) | ((v & 2) << 1) | ((v & 4) << 2);
+	}
+
+	// position of texel (x, y) of a tile (x, y < Texture::tile_size) in Z-order: bits of x and y interleaved.
+	struct tile_order {
+		unsigned char index[Texture::tile_size*Texture::tile_size];
+		tile_order() {
+			for (int y = 0; y < Texture::tile_size; y++) {
+				for (int x = 0; x < Texture::tile_size; x++) {
+					index[y*Texture::tile_size + x] = (unsigned char)(spread_bits(x) | (spread_bits(y) << 1));
+				}
+			}
+		}
+	};
+	const tile_order morton;
+}
+
+Texture::Texture() : bytespp_(0), layout_(TEXTURE_LAYOUT_TILED), filter_(TEXTURE_FILTER_TRILINEAR) {
+}
+
+void Texture::build(const TGAImage &img, TextureLayout layout) {
+	mapped_.close();
+	build(img.buffer() ? img.row(0) : NULL, img.row_bytes(), img.get_width(), img.get_height(), img.get_bytespp(), layout, false);
+}
+
+bool Texture::map(const char *filename, TextureLayout layout) {
+	if (!mapped_.open(filename)) {
+		build(NULL, 0, 0, 0, 0, layout, false);
+		return false;
+	}
+	const bool in_place = layout == TEXTURE_LAYOUT_LINEAR;
+	build(mapped_.row(0), mapped_.stride(), mapped_.get_width(), mapped_.get_height(), mapped_.get_bytespp(), layout, in_place);
+	if (!in_place) mapped_.close();
+	return true;
+}
+
+void Texture::build(const unsigned char *row0, ptrdiff_t stride, int w, int h, int bytespp, TextureLayout layout, bool in_place) {
+	levels_.clear();
+	texels_.clear();
+	bytespp_ = bytespp;
+	layout_ = layout;
+	if (!row0 || w <= 0 || h <= 0) return;
+
+	// sizes first, so texels_ is allocated once.
+	std::vector<size_t> first;
+	size_t total = 0;
+	for (int lw = w, lh = h;; lw = std::max(1, lw / 2), lh = std::max(1, lh / 2)) {
+		const int tiles_x = (lw + tile_size - 1) / tile_size;
+		const int tiles_y = (lh + tile_size - 1) / tile_size;
+		mip_level level = { lw, lh, tiles_x, NULL, (ptrdiff_t)lw*bytespp_ };
+		levels_.push_back(level);
+		first.push_back(total);
+		if (!(in_place && levels_.size() == 1)) {
+			total += layout_ == TEXTURE_LAYOUT_TILED ? (size_t)tiles_x*tiles_y*tile_size*tile_size : (size_t)lw*lh;
+		}
+		if (lw == 1 && lh == 1) break;
+	}
+	texels_.resize(total*bytespp_);
+	for (size_t l = 0; l < levels_.size(); l++) {
+		levels_[l].base = texels_.data() + first[l]*bytespp_;
+	}
+
+	if (in_place) {
+		levels_[0].base = row0;
+		levels_[0].stride = stride;
+	}
+	else if (layout_ == TEXTURE_LAYOUT_TILED) {
+		switch (bytespp_) {
+		case Gray8::bytespp: load_tiled<Gray8>(row0, stride); break;
+		case RGB8::bytespp: load_tiled<RGB8>(row0, stride); break;
+		case RGBA8::bytespp: load_tiled<RGBA8>(row0, stride); break;
+		}
+	}
+	else {
+		for (int y = 0; y < h; y++) {
+			memcpy(texels_.data() + y*levels_[0].stride, row0 + y*stride, (size_t)w*bytespp_);
+		}
+	}
+
+	// each texel of a level is the average of the 2x2 texels it covers in the level before.
+	// an odd last row/column of the level before is folded into the texels next to it: the last texel of an odd
+	// row averages 3 columns (3 rows for the last row, 3x3 in the corner), so every texel counts in the next level.
+	for (int l = 1; l < (int)levels_.size(); l++) {
+		const mip_level &src = levels_[l - 1];
+		const mip_level &dst = levels_[l];
+		// levels after 0 are always in texels_.
+		unsigned char *dst_base = texels_.data() + first[l]*bytespp_;
+		for (int y = 0; y < dst.height; y++) {
+			const int y0 = std::min(2 * y, src.height - 1);
+			const int y1 = y + 1 < dst.height ? y0 + 1 : src.height - 1;
+			for (int x = 0; x < dst.width; x++) {
+				const int x0 = std::min(2 * x, src.width - 1);
+				const int x1 = x + 1 < dst.width ? x0 + 1 : src.width - 1;
+				const int count = (x1 - x0 + 1)*(y1 - y0 + 1);
+				int sum[4] = { 0, 0, 0, 0 };
+				for (int sy = y0; sy <= y1; sy++) {
+					for (int sx = x0; sx <= x1; sx++) {
+						const unsigned char *p = texel(l - 1, sx, sy);
+						for (int c = 0; c < bytespp_; c++) sum[c] += p[c];
+					}
+				}
+				unsigned char *out = dst_base + offset(dst, x, y);
+				for (int c = 0; c < bytespp_; c++) {
+					out[c] = (unsigned char)((sum[c] + count / 2) / count);
+				}
+			}
+		}
+	}
+}
+
+template <class pixel> void Texture::load_tiled(const unsigned char *row0, ptrdiff_t stride) {
+	const mip_level &l = levels_[0];
+	pixel *dst = reinterpret_cast<pixel *>(texels_.data());
+	for (int y = 0; y < l.height; y++) {
+		const pixel *row = reinterpret_cast<const pixel *>(row0 + y*stride);
+		for (int x = 0; x < l.width; x++) {
+			*reinterpret_cast<pixel *>((unsigned char *)dst + offset(l, x, y)) = row[x];
+		}
+	}
+}
+
+float Texture::lod(const Vec2f &duvdx, const Vec2f &duvdy) const {
+	if (levels_.empty()) return 0.f;
+	const float w = (float)levels_[0].width;
+	const float h = (float)levels_[0].height;
+	const float dx2 = duvdx.x*duvdx.x*w*w + duvdx.y*duvdx.y*h*h;
+	const float dy2 = duvdy.x*duvdy.x*w*w + duvdy.y*duvdy.y*h*h;
+	const float rho2 = std::max(dx2, dy2);
+	// log2(sqrt(rho2)), anything below one texel per pixel is level 0.
+	return rho2 > 1.f ? 0.5f*std::log2(rho2) : 0.f;
+}
+
+ptrdiff_t Texture::offset(const mip_level &l, int x, int y) const {
+	if (layout_ == TEXTURE_LAYOUT_TILED) {
+		// x, y >= 0, unsigned keeps / and % plain shifts and masks.
+		const unsigned ux = x, uy = y;
+		const size_t tile = (size_t)(uy / tile_size)*l.tiles_x + ux / tile_size;
+		return (ptrdiff_t)((tile*tile_size*tile_size + morton.index[(uy % tile_size)*tile_size + ux % tile_size])*bytespp_);
+	}
+	return y*l.stride + x*bytespp_;
+}
+
+const unsigned char *Texture::texel(int level, int x, int y) const {
+	const mip_level &l = levels_[level];
+	x = std::min(std::max(x, 0), l.width - 1);
+	y = std::min(std::max(y, 0), l.height - 1);
+	return l.base + offset(l, x, y);
+}
+
+TGAColor Texture::fetch(int level, int x, int y) const {
+	if (levels_.empty()) return TGAColor();
+	return TGAColor(texel(level, x, y), (unsigned char)bytespp_);
+}
+
+TGAColor Texture::sample_nearest(Vec2f uv, int level) const {
+	if (levels_.empty()) return TGAColor();
+	level = std::min(std::max(level, 0), (int)levels_.size() - 1);
+	return fetch(level, (int)std::floor(uv.x*levels_[level].width), (int)std::floor(uv.y*levels_[level].height));
+}
+
+void Texture::bilinear(Vec2f uv, int level, float *out) const {
+	const mip_level &l = levels_[level];
+	// texel centers are at half integers.
+	const float x = uv.x*l.width - 0.5f;
+	const float y = uv.y*l.height - 0.5f;
+	const float fx = std::floor(x);
+	const float fy = std::floor(y);
+	const int x0 = (int)fx;
+	const int y0 = (int)fy;
+	const float tx = x - fx;
+	const float ty = y - fy;
+	// clamp the 2x2 footprint once.
+	const int left = std::min(std::max(x0, 0), l.width - 1), right = std::min(std::max(x0 + 1, 0), l.width - 1);
+	const int bottom = std::min(std::max(y0, 0), l.height - 1), top = std::min(std::max(y0 + 1, 0), l.height - 1);
+	const unsigned char *p00 = l.base + offset(l, left, bottom);
+	const unsigned char *p10 = l.base + offset(l, right, bottom);
+	const unsigned char *p01 = l.base + offset(l, left, top);
+	const unsigned char *p11 = l.base + offset(l, right, top);
+	for (int c = 0; c < bytespp_; c++) {
+		const float lower = p00[c] + (p10[c] - p00[c])*tx;
+		const float upper = p01[c] + (p11[c] - p01[c])*tx;
+		out[c] = lower + (upper - lower)*ty;
+	}
+}
+
+TGAColor Texture::to_color(const float *channels) const {
+	unsigned char bytes[4] = { 0, 0, 0, 0 };
+	for (int c = 0; c < bytespp_; c++) {
+		bytes[c] = (unsigned char)std::min(255.f, channels[c] + 0.5f);
+	}
+	return TGAColor(bytes, (unsigned char)bytespp_);
+}
+
+TGAColor Texture::sample_bilinear(Vec2f uv, int level) const {
+	if (levels_.empty()) return TGAColor();
+	level = std::min(std::max(level, 0), (int)levels_.size() - 1);
+	float channels[4];
+	bilinear(uv, level, channels);
+	return to_color(channels);
+}
+
+TGAColor Texture::sample_trilinear(Vec2f uv, float lod) const {
+	if (levels_.empty()) return TGAColor();
+	const int last = (int)levels_.size() - 1;
+	lod = std::min(std::max(lod, 0.f), (float)last);
+	const int level = std::min((int)lod, last);
+	const float t = lod - level;
+	float channels[4];
+	bilinear(uv, level, channels);
+	if (t > 0.f && level < last) {
+		float coarser[4];
+		bilinear(uv, level + 1, coarser);
+		for (int c = 0; c < bytespp_; c++) {
+			channels[c] += (coarser[c] - channels[c])*t;
+		}
+	}
+	return to_color(channels);
+}
+
+TGAColor Texture::sample(Vec2f uv, const Vec2f &duvdx, const Vec2f &duvdy) const {
+	switch (filter_) {
+	case TEXTURE_FILTER_NEAREST:
+		return sample_nearest(uv);
+	case TEXTURE_FILTER_BILINEAR:
+		return sample_bilinear(uv, (int)(lod(duvdx, duvdy) + 0.5f));
+	default:
+		return sample_trilinear(uv, lod(duvdx, duvdy));
+	}
+}
@@ -0,0 +1,97 @@
+#ifndef __TEXTURE_H__
+#define __TEXTURE_H__
+
+#include <stddef.h>
+#include <vector>
+#include "geometry.h"
+#include "mappedtga.h"
+#include "tgaimage.h"
+
+enum TextureFilter {
+	TEXTURE_FILTER_NEAREST, // texel of level 0 the uv falls in, what TGAImage::get lookups did
+	TEXTURE_FILTER_BILINEAR, // 4 texels of the level selected by lod
+	TEXTURE_FILTER_TRILINEAR // bilinear in the two levels around lod, blended
+};
+
+enum TextureLayout {
+	TEXTURE_LAYOUT_LINEAR, // rows one after the other, like TGAImage
+	TEXTURE_LAYOUT_TILED // 8x8 texel tiles, row after row of tiles, texels of a tile in Z-order (Morton order)
+};
+
+// Read only image with its mip chain, sampled by uv in [0, 1] (clamped to the edges).
+// level 0 is the image, every next level is half the size of the one before (2x2 box filter) down to 1x1,
+// all levels in one allocation. lod selects the level whose texels are about one pixel in size on screen,
+// so a model far away reads a few small levels instead of jumping around a big texture.
+// in the tiled layout texels close to each other in u and v are close in memory whatever direction a triangle
+// runs through the texture: a 2x2 bilinear footprint is in one tile most of the time, and walking along v
+// touches a new cache line every 8 texels instead of on every texel. levels are padded to whole tiles.
+// a texture mapped from an uncompressed tga file in the linear layout reads level 0 straight from the mapping.
+class Texture {
+public:
+	static const int tile_size = 8;
+
+	Texture();
+
+	// replace the contents by img and its mip chain, stored in layout.
+	void build(const TGAImage &img, TextureLayout layout = TEXTURE_LAYOUT_TILED);
+	// replace the contents by the uncompressed tga file filename (see MappedTGA), row 0 being the bottom of the picture.
+	// in the linear layout level 0 is not copied at all and its pages are shared with every process mapping the file,
+	// but fetches lose the locality of tiles (see TextureLayout). the tiled layout is filled from the mapping without
+	// decoding the file into a TGAImage first, at the cost of one copy of level 0 on the heap.
+	// linear is the default as it is the only zero-copy case (Model's default too).
+	// false (and empty) when the file can't be mapped, rle files have to be read into a TGAImage and built from that.
+	bool map(const char *filename, TextureLayout layout = TEXTURE_LAYOUT_LINEAR);
+	bool mapped() const { return mapped_.is_open(); }
+	bool empty() const { return levels_.empty(); }
+
+	int levels() const { return (int)levels_.size(); }
+	int width(int level = 0) const { return levels_[level].width; }
+	int height(int level = 0) const { return levels_[level].height; }
+	int bytespp() const { return bytespp_; }
+	TextureLayout layout() const { return layout_; }
+	// bytes of the levels on the heap (all but a mapped level 0), padding included.
+	size_t size() const { return texels_.size(); }
+
+	void set_filter(TextureFilter filter) { filter_ = filter; }
+	TextureFilter filter() const { return filter_; }
+
+	// level of detail for the uv derivatives along screen x and y: log2 of the texels of level 0 one pixel spans.
+	float lod(const Vec2f &duvdx, const Vec2f &duvdy) const;
+
+	// texel (x, y) of level, coordinates clamped to the level.
+	TGAColor fetch(int level, int x, int y) const;
+	TGAColor sample_nearest(Vec2f uv, int level = 0) const;
+	TGAColor sample_bilinear(Vec2f uv, int level) const;
+	TGAColor sample_trilinear(Vec2f uv, float lod) const;
+	// sample with filter(), lod from the uv derivatives (see BarycentricBlock::QuadDerivatives).
+	TGAColor sample(Vec2f uv, const Vec2f &duvdx, const Vec2f &duvdy) const;
+
+private:
+	struct mip_level {
+		int width;
+		int height;
+		int tiles_x; // tiles per row of tiles, tiled layout only
+		const unsigned char *base; // texel (0, 0), in texels_ or in the mapping
+		ptrdiff_t stride; // bytes from a row to the next, linear layout only
+	};
+
+	std::vector<mip_level> levels_;
+	std::vector<unsigned char> texels_;
+	MappedTGA mapped_;
+	int bytespp_;
+	TextureLayout layout_;
+	TextureFilter filter_;
+
+	// level 0 of w x h texels starting at row0, rows stride bytes apart. it is used in place when in_place is set.
+	void build(const unsigned char *row0, ptrdiff_t stride, int w, int h, int bytespp, TextureLayout layout, bool in_place);
+	// bytes from the level's base to texel (x, y).
+	ptrdiff_t offset(const mip_level &l, int x, int y) const;
+	const unsigned char *texel(int level, int x, int y) const;
+	// tiled level 0 from rows of pixel.
+	template <class pixel> void load_tiled(const unsigned char *row0, ptrdiff_t stride);
+	// channels of the bilinear sample of level, not rounded.
+	void bilinear(Vec2f uv, int level, float *out) const;
+	TGAColor to_color(const float *channels) const;
+};
+
+#endif //__TEXTURE_H__
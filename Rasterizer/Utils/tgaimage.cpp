@@ -1,56 +1,200 @@
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <string.h>
 #include <time.h>
+#include <vector>
 #include <math.h>
+#include <stdint.h>
 #include "tgaimage.h"
 
-TGAImage::TGAImage() : data(NULL), width(0), height(0), bytespp(0) {
+namespace {
+	// over-allocate and keep the address new[] returned just in front of the aligned block.
+	unsigned char *allocate_aligned(size_t nbytes) {
+		unsigned char *raw = new unsigned char[nbytes + TGAImage::alignment + sizeof(void *)];
+		uintptr_t aligned = ((uintptr_t)(raw + sizeof(void *)) + TGAImage::alignment - 1) & ~(uintptr_t)(TGAImage::alignment - 1);
+		reinterpret_cast<unsigned char **>(aligned)[-1] = raw;
+		return reinterpret_cast<unsigned char *>(aligned);
+	}
+
+	void free_aligned(unsigned char *data) {
+		if (data) delete[] reinterpret_cast<unsigned char **>(data)[-1];
+	}
 }
 
-TGAImage::TGAImage(int w, int h, int bpp) : data(NULL), width(w), height(h), bytespp(bpp) {
-	unsigned long nbytes = width*height*bytespp;
-	data = new unsigned char[nbytes];
-	memset(data, 0, nbytes);
+TGAImage::TGAImage() : data(NULL), capacity(0), width(0), height(0), bytespp(0) {
 }
 
-TGAImage::TGAImage(const TGAImage &img) : data(NULL), width(img.width), height(img.height), bytespp(img.bytespp) {
-	unsigned long nbytes = width*height*bytespp;
-	data = new unsigned char[nbytes];
+TGAImage::TGAImage(int w, int h, int bpp) : data(NULL), capacity(0), width(0), height(0), bytespp(0) {
+	resize(w, h, bpp);
+}
+
+TGAImage::TGAImage(const TGAImage &img) : data(NULL), capacity(0), width(img.width), height(img.height), bytespp(img.bytespp) {
+	if (!img.data) return;
+	size_t nbytes = (size_t)width*height*bytespp;
+	reserve(nbytes);
 	memcpy(data, img.data, nbytes);
 }
 
+TGAImage::TGAImage(TGAImage &&img) noexcept : data(img.data), capacity(img.capacity), width(img.width), height(img.height), bytespp(img.bytespp) {
+	img.data = NULL;
+	img.capacity = 0;
+	img.width = img.height = img.bytespp = 0;
+}
+
 TGAImage::~TGAImage() {
-	if (data) delete[] data;
+	free_aligned(data);
 }
 
 TGAImage & TGAImage::operator =(const TGAImage &img) {
 	if (this != &img) {
-		if (data) delete[] data;
+		if (!img.data) {
+			release();
+			return *this;
+		}
 		width = img.width;
 		height = img.height;
 		bytespp = img.bytespp;
-		unsigned long nbytes = width*height*bytespp;
-		data = new unsigned char[nbytes];
+		size_t nbytes = (size_t)width*height*bytespp;
+		reserve(nbytes);
 		memcpy(data, img.data, nbytes);
 	}
 	return *this;
 }
 
-bool TGAImage::read_tga_file(const char *filename) {
-	if (data) delete[] data;
+TGAImage & TGAImage::operator =(TGAImage &&img) noexcept {
+	if (this != &img) {
+		free_aligned(data);
+		data = img.data;
+		capacity = img.capacity;
+		width = img.width;
+		height = img.height;
+		bytespp = img.bytespp;
+		img.data = NULL;
+		img.capacity = 0;
+		img.width = img.height = img.bytespp = 0;
+	}
+	return *this;
+}
+
+void TGAImage::swap(TGAImage &img) noexcept {
+	std::swap(data, img.data);
+	std::swap(capacity, img.capacity);
+	std::swap(width, img.width);
+	std::swap(height, img.height);
+	std::swap(bytespp, img.bytespp);
+}
+
+bool TGAImage::resize(int w, int h, int bpp) {
+	if (w <= 0 || h <= 0 || bpp <= 0) {
+		release();
+		return false;
+	}
+	width = w;
+	height = h;
+	bytespp = bpp;
+	size_t nbytes = (size_t)width*height*bytespp;
+	reserve(nbytes);
+	memset(data, 0, nbytes);
+	return true;
+}
+
+void TGAImage::reserve(size_t nbytes) {
+	if (data && nbytes <= capacity) return;
+	free_aligned(data);
+	data = allocate_aligned(nbytes);
+	capacity = nbytes;
+}
+
+void TGAImage::release() {
+	free_aligned(data);
 	data = NULL;
+	capacity = 0;
+	width = height = bytespp = 0;
+}
+
+namespace {
+	const unsigned char developer_area_ref[4] = { 0, 0, 0, 0 };
+	const unsigned char extension_area_ref[4] = { 0, 0, 0, 0 };
+	const unsigned char footer[18] = { 'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0' };
+	const int max_chunk_length = 128;
+
+	// pixel comparison of the rle encoder, one or two loads instead of a loop over bytes.
+	template <int bpp> inline bool same_pixel(const unsigned char *a, const unsigned char *b);
+	template <> inline bool same_pixel<1>(const unsigned char *a, const unsigned char *b) {
+		return *a == *b;
+	}
+	template <> inline bool same_pixel<3>(const unsigned char *a, const unsigned char *b) {
+		unsigned short a01, b01;
+		memcpy(&a01, a, 2);
+		memcpy(&b01, b, 2);
+		return a01 == b01 && a[2] == b[2];
+	}
+	template <> inline bool same_pixel<4>(const unsigned char *a, const unsigned char *b) {
+		unsigned int a0123, b0123;
+		memcpy(&a0123, a, 4);
+		memcpy(&b0123, b, 4);
+		return a0123 == b0123;
+	}
+
+	// rle chunks of npixels pixels appended to out. chunks are the ones the stream encoder wrote byte by byte:
+	// a run chunk for two or more equal pixels, a raw chunk up to the pixel before the next pair of equal ones,
+	// both at most 128 pixels long.
+	template <int bpp> unsigned char *encode_rle(const unsigned char *data, size_t npixels, unsigned char *out) {
+		size_t curpix = 0;
+		while (curpix < npixels) {
+			const unsigned char *chunk = data + curpix*bpp;
+			const size_t left = std::min(npixels - curpix, (size_t)max_chunk_length);
+			size_t length = 1;
+			if (left > 1 && same_pixel<bpp>(chunk, chunk + bpp)) {
+				length = 2;
+				while (length < left && same_pixel<bpp>(chunk, chunk + length*bpp)) length++;
+				*out++ = (unsigned char)(length + 127);
+				memcpy(out, chunk, bpp);
+				out += bpp;
+			}
+			else {
+				// raw chunk stops before the first of two equal pixels within its 128 pixel window.
+				length = std::min(left, (size_t)2);
+				while (length < left) {
+					if (same_pixel<bpp>(chunk + (length - 1)*bpp, chunk + length*bpp)) {
+						length--;
+						break;
+					}
+					length++;
+				}
+				*out++ = (unsigned char)(length - 1);
+				memcpy(out, chunk, length*bpp);
+				out += length*bpp;
+			}
+			curpix += length;
+		}
+		return out;
+	}
+}
+
+// a run never takes more bytes than its pixels, a raw chunk takes one more. raw chunks end at a run
+// (of at least 2 pixels) or after 128 pixels, so there are at most npixels/2 + npixels/128 + 1 of them.
+size_t TGAImage::rle_bound(size_t npixels) const {
+	return npixels*bytespp + npixels / 2 + npixels / max_chunk_length + 1;
+}
+
+bool TGAImage::read_tga_file(const char *filename) {
 	std::ifstream in;
-	in.open(filename, std::ios::binary);
+	in.open(filename, std::ios::binary | std::ios::ate);
 	if (!in.is_open()) {
 		std::cerr << "can't open file " << filename << "\n";
 		in.close();
+		release();
 		return false;
 	}
+	const size_t file_size = (size_t)in.tellg();
+	in.seekg(0);
 	TGA_Header header;
 	in.read((char *)&header, sizeof(header));
 	if (!in.good()) {
 		in.close();
+		release();
 		std::cerr << "an error occured while reading the header\n";
 		return false;
 	}
@@ -59,31 +203,41 @@ bool TGAImage::read_tga_file(const char *filename) {
 	bytespp = header.bitsperpixel >> 3;
 	if (width <= 0 || height <= 0 || (bytespp != GRAYSCALE && bytespp != RGB && bytespp != RGBA)) {
 		in.close();
+		release();
 		std::cerr << "bad bpp (or width/height) value\n";
 		return false;
 	}
+	const bool raw = 3 == header.datatypecode || 2 == header.datatypecode;
+	if (!raw && 10 != header.datatypecode && 11 != header.datatypecode) {
+		in.close();
+		release();
+		std::cerr << "unknown file format " << (int)header.datatypecode << "\n";
+		return false;
+	}
+	in.seekg(sizeof(header) + (unsigned char)header.idlength);
+	// the pixels go into the current buffer when they fit. a failure below leaves the image empty, never half read.
 	unsigned long nbytes = bytespp*width*height;
-	data = new unsigned char[nbytes];
-	if (3 == header.datatypecode || 2 == header.datatypecode) {
+	reserve(nbytes);
+	if (raw) {
 		in.read((char *)data, nbytes);
 		if (!in.good()) {
 			in.close();
+			release();
 			std::cerr << "an error occured while reading the data\n";
 			return false;
 		}
 	}
-	else if (10 == header.datatypecode || 11 == header.datatypecode) {
-		if (!load_rle_data(in)) {
+	else {
+		// rest of the file in one read, chunks are decoded from memory.
+		std::vector<unsigned char> chunks(file_size - std::min(file_size, (size_t)in.tellg()));
+		in.read((char *)chunks.data(), chunks.size());
+		if (!in.good() || !load_rle_data(chunks.data(), chunks.size())) {
 			in.close();
+			release();
 			std::cerr << "an error occured while reading the data\n";
 			return false;
 		}
 	}
-	else {
-		in.close();
-		std::cerr << "unknown file format " << (int)header.datatypecode << "\n";
-		return false;
-	}
 	if (!(header.imagedescriptor & 0x20)) {
 		flip_vertically();
 	}
@@ -95,60 +249,48 @@ bool TGAImage::read_tga_file(const char *filename) {
 	return true;
 }
 
-bool TGAImage::load_rle_data(std::ifstream &in) {
-	unsigned long pixelcount = width*height;
-	unsigned long currentpixel = 0;
-	unsigned long currentbyte = 0;
-	TGAColor colorbuffer;
-	do {
-		unsigned char chunkheader = 0;
-		chunkheader = in.get();
-		if (!in.good()) {
+// raw chunks are copied, runs filled by doubling the filled part, whole chunks at a time.
+bool TGAImage::load_rle_data(const unsigned char *in, size_t size) {
+	const size_t nbytes = (size_t)width*height*bytespp;
+	const unsigned char *end = in + size;
+	size_t currentbyte = 0;
+	while (currentbyte < nbytes) {
+		if (in == end) {
 			std::cerr << "an error occured while reading the data\n";
 			return false;
 		}
-		if (chunkheader < 128) {
-			chunkheader++;
-			for (int i = 0; i < chunkheader; i++) {
-				in.read((char *)colorbuffer.bgra, bytespp);
-				if (!in.good()) {
-					std::cerr << "an error occured while reading the header\n";
-					return false;
-				}
-				for (int t = 0; t < bytespp; t++)
-					data[currentbyte++] = colorbuffer.bgra[t];
-				currentpixel++;
-				if (currentpixel > pixelcount) {
-					std::cerr << "Too many pixels read\n";
-					return false;
-				}
-			}
+		const unsigned char chunkheader = *in++;
+		const bool raw = chunkheader < 128;
+		const size_t chunkbytes = (raw ? chunkheader + 1 : chunkheader - 127)*(size_t)bytespp;
+		if (currentbyte + chunkbytes > nbytes) {
+			std::cerr << "Too many pixels read\n";
+			return false;
+		}
+		const size_t readbytes = raw ? chunkbytes : bytespp;
+		if ((size_t)(end - in) < readbytes) {
+			std::cerr << "an error occured while reading the data\n";
+			return false;
+		}
+		unsigned char *out = data + currentbyte;
+		if (raw) {
+			memcpy(out, in, chunkbytes);
+		}
+		else if (bytespp == 1) {
+			memset(out, *in, chunkbytes);
 		}
 		else {
-			chunkheader -= 127;
-			in.read((char *)colorbuffer.bgra, bytespp);
-			if (!in.good()) {
-				std::cerr << "an error occured while reading the header\n";
-				return false;
-			}
-			for (int i = 0; i < chunkheader; i++) {
-				for (int t = 0; t < bytespp; t++)
-					data[currentbyte++] = colorbuffer.bgra[t];
-				currentpixel++;
-				if (currentpixel > pixelcount) {
-					std::cerr << "Too many pixels read\n";
-					return false;
-				}
+			memcpy(out, in, bytespp);
+			for (size_t filled = bytespp; filled < chunkbytes; filled *= 2) {
+				memcpy(out + filled, out, std::min(filled, chunkbytes - filled));
 			}
 		}
-	} while (currentpixel < pixelcount);
+		in += readbytes;
+		currentbyte += chunkbytes;
+	}
 	return true;
 }
 
 bool TGAImage::write_tga_file(const char *filename, bool rle) {
-	unsigned char developer_area_ref[4] = { 0, 0, 0, 0 };
-	unsigned char extension_area_ref[4] = { 0, 0, 0, 0 };
-	unsigned char footer[18] = { 'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0' };
 	std::ofstream out;
 	out.open(filename, std::ios::binary);
 	if (!out.is_open()) {
@@ -163,40 +305,23 @@ bool TGAImage::write_tga_file(const char *filename, bool rle) {
 	header.height = height;
 	header.datatypecode = (bytespp == GRAYSCALE ? (rle ? 11 : 3) : (rle ? 10 : 2));
 	header.imagedescriptor = 0x20; // top-left origin
-	out.write((char *)&header, sizeof(header));
-	if (!out.good()) {
-		out.close();
-		std::cerr << "can't dump the tga file\n";
-		return false;
+
+	// rle chunks are encoded into memory first, then written with one call.
+	const size_t nbytes = (size_t)width*height*bytespp;
+	std::vector<unsigned char> chunks;
+	if (rle) {
+		unload_rle_data(chunks);
 	}
-	if (!rle) {
-		out.write((char *)data, width*height*bytespp);
-		if (!out.good()) {
-			std::cerr << "can't unload raw data\n";
-			out.close();
-			return false;
-		}
+	out.write((const char *)&header, sizeof(header));
+	if (rle) {
+		out.write((const char *)chunks.data(), chunks.size());
 	}
 	else {
-		if (!unload_rle_data(out)) {
-			out.close();
-			std::cerr << "can't unload rle data\n";
-			return false;
-		}
+		out.write((const char *)data, nbytes);
 	}
-	out.write((char *)developer_area_ref, sizeof(developer_area_ref));
-	if (!out.good()) {
-		std::cerr << "can't dump the tga file\n";
-		out.close();
-		return false;
-	}
-	out.write((char *)extension_area_ref, sizeof(extension_area_ref));
-	if (!out.good()) {
-		std::cerr << "can't dump the tga file\n";
-		out.close();
-		return false;
-	}
-	out.write((char *)footer, sizeof(footer));
+	out.write((const char *)developer_area_ref, sizeof(developer_area_ref));
+	out.write((const char *)extension_area_ref, sizeof(extension_area_ref));
+	out.write((const char *)footer, sizeof(footer));
 	if (!out.good()) {
 		std::cerr << "can't dump the tga file\n";
 		out.close();
@@ -206,47 +331,19 @@ bool TGAImage::write_tga_file(const char *filename, bool rle) {
 	return true;
 }
 
-// TODO: it is not necessary to break a raw chunk for two equal pixels (for the matter of the resulting size)
-bool TGAImage::unload_rle_data(std::ofstream &out) {
-	const unsigned char max_chunk_length = 128;
-	unsigned long npixels = width*height;
-	unsigned long curpix = 0;
-	while (curpix < npixels) {
-		unsigned long chunkstart = curpix*bytespp;
-		unsigned long curbyte = curpix*bytespp;
-		unsigned char run_length = 1;
-		bool raw = true;
-		while (curpix + run_length < npixels && run_length < max_chunk_length) {
-			bool succ_eq = true;
-			for (int t = 0; succ_eq && t < bytespp; t++) {
-				succ_eq = (data[curbyte + t] == data[curbyte + t + bytespp]);
-			}
-			curbyte += bytespp;
-			if (1 == run_length) {
-				raw = !succ_eq;
-			}
-			if (raw && succ_eq) {
-				run_length--;
-				break;
-			}
-			if (!raw && !succ_eq) {
-				break;
-			}
-			run_length++;
-		}
-		curpix += run_length;
-		out.put(raw ? run_length - 1 : run_length + 127);
-		if (!out.good()) {
-			std::cerr << "can't dump the tga file\n";
-			return false;
-		}
-		out.write((char *)(data + chunkstart), (raw ? run_length*bytespp : bytespp));
-		if (!out.good()) {
-			std::cerr << "can't dump the tga file\n";
-			return false;
-		}
+// appends the rle chunks of the pixels to out. a raw chunk ends before two equal pixels even when a run of
+// two saves nothing, which keeps files byte for byte what the stream encoder wrote before.
+void TGAImage::unload_rle_data(std::vector<unsigned char> &out) {
+	const size_t npixels = (size_t)width*height;
+	const size_t start = out.size();
+	out.resize(start + rle_bound(npixels));
+	unsigned char *end = out.data() + start;
+	switch (bytespp) {
+	case 1: end = encode_rle<1>(data, npixels, end); break;
+	case 3: end = encode_rle<3>(data, npixels, end); break;
+	case 4: end = encode_rle<4>(data, npixels, end); break;
 	}
-	return true;
+	out.resize(end - out.data());
 }
 
 TGAColor TGAImage::get(int x, int y) {
@@ -272,27 +369,26 @@ bool TGAImage::set(int x, int y, const TGAColor &c) {
 	return true;
 }
 
-int TGAImage::get_bytespp() {
+int TGAImage::get_bytespp() const {
 	return bytespp;
 }
 
-int TGAImage::get_width() {
+int TGAImage::get_width() const {
 	return width;
 }
 
-int TGAImage::get_height() {
+int TGAImage::get_height() const {
 	return height;
 }
 
 bool TGAImage::flip_horizontally() {
 	if (!data) return false;
 	int half = width >> 1;
-	for (int i = 0; i < half; i++) {
-		for (int j = 0; j < height; j++) {
-			TGAColor c1 = get(i, j);
-			TGAColor c2 = get(width - 1 - i, j);
-			set(i, j, c2);
-			set(width - 1 - i, j, c1);
+	for (int j = 0; j < height; j++) {
+		unsigned char *left = row(j);
+		unsigned char *right = row(j) + (width - 1)*bytespp;
+		for (int i = 0; i < half; i++, left += bytespp, right -= bytespp) {
+			std::swap_ranges(left, left + bytespp, right);
 		}
 	}
 	return true;
@@ -318,13 +414,18 @@ unsigned char *TGAImage::buffer() {
 	return data;
 }
 
+const unsigned char *TGAImage::buffer() const {
+	return data;
+}
+
 void TGAImage::clear() {
 	memset((void *)data, 0, width*height*bytespp);
 }
 
 bool TGAImage::scale(int w, int h) {
 	if (w <= 0 || h <= 0 || !data) return false;
-	unsigned char *tdata = new unsigned char[w*h*bytespp];
+	// the old pixels are read while the new ones are written, so scaling needs a second buffer.
+	unsigned char *tdata = allocate_aligned((size_t)w*h*bytespp);
 	int nscanline = 0;
 	int oscanline = 0;
 	int erry = 0;
@@ -352,8 +453,9 @@ bool TGAImage::scale(int w, int h) {
 			nscanline += nlinebytes;
 		}
 	}
-	delete[] data;
+	free_aligned(data);
 	data = tdata;
+	capacity = (size_t)w*h*bytespp;
 	width = w;
 	height = h;
 	return true;
@@ -2,6 +2,8 @@
 #define __IMAGE_H__
 
 #include <fstream>
+#include <stddef.h>
+#include <vector>
 
 #pragma pack(push,1)
 struct TGA_Header {
@@ -66,39 +68,122 @@ struct TGAColor {
 	}
 };
 
+// pixels as TGAImage stores them for each of its formats, bytes in the order of TGAColor::bgra.
+// converting from a TGAColor takes its first bytespp bytes, like TGAImage::set does.
+struct Gray8 {
+	static const int bytespp = 1;
+	unsigned char v;
 
+	Gray8() : v(0) {}
+	explicit Gray8(const TGAColor &c) : v(c.bgra[0]) {}
+	TGAColor color() const { return TGAColor(v); }
+};
+
+struct RGB8 {
+	static const int bytespp = 3;
+	unsigned char bgr[3];
+
+	RGB8() : bgr() {}
+	explicit RGB8(const TGAColor &c) { bgr[0] = c.bgra[0]; bgr[1] = c.bgra[1]; bgr[2] = c.bgra[2]; }
+	TGAColor color() const { return TGAColor(bgr, bytespp); }
+};
+
+struct RGBA8 {
+	static const int bytespp = 4;
+	unsigned char bgra[4];
+
+	RGBA8() : bgra() {}
+	explicit RGBA8(const TGAColor &c) { bgra[0] = c.bgra[0]; bgra[1] = c.bgra[1]; bgra[2] = c.bgra[2]; bgra[3] = c.bgra[3]; }
+	TGAColor color() const { return TGAColor(bgra, bytespp); }
+};
+
+// the pixels of a TGAImage as rows of pixel (Gray8, RGB8 or RGBA8), without any check per access:
+// format is checked once when the view is made (see TGAImage::view), coordinates are up to the caller.
+// valid as long as the image is neither resized nor reassigned.
+template <class pixel> class ImageView {
+public:
+	ImageView() : data_(NULL), width_(0), height_(0) {}
+	ImageView(pixel *data, int w, int h) : data_(data), width_(w), height_(h) {}
+
+	bool empty() const { return data_ == NULL; }
+	int width() const { return width_; }
+	int height() const { return height_; }
+	// width() pixels of row y.
+	pixel *row(int y) const { return data_ + (size_t)y*width_; }
+	pixel &operator ()(int x, int y) const { return data_[(size_t)y*width_ + x]; }
+
+private:
+	pixel *data_;
+	int width_;
+	int height_;
+};
+
+
+// pixels are in one buffer aligned to alignment bytes. the buffer is kept when the image gets smaller or the same
+// size (resize, assignment, read_tga_file), so an image reused for every frame allocates once. images are moved
+// (or swapped) without copying their pixels, e.g. when returned from a function or stored in a std::vector.
 class TGAImage {
 protected:
 	unsigned char* data;
+	size_t capacity; // bytes of the buffer at data, at least width*height*bytespp
 	int width;
 	int height;
 	int bytespp;
 
-	bool   load_rle_data(std::ifstream &in);
-	bool unload_rle_data(std::ofstream &out);
+	bool   load_rle_data(const unsigned char *in, size_t size);
+	void unload_rle_data(std::vector<unsigned char> &out);
+	// most bytes unload_rle_data can append for npixels pixels.
+	size_t rle_bound(size_t npixels) const;
+	// a buffer of at least nbytes at data, the old one when it is big enough. contents are undefined.
+	void reserve(size_t nbytes);
+	// free the buffer and make the image empty: data is NULL, width, height and bytespp are 0.
+	void release();
 public:
 	enum Format {
 		GRAYSCALE = 1, RGB = 3, RGBA = 4
 	};
+	// of buffer(), a multiple of the cache line size and of the widest SIMD register.
+	static const size_t alignment = 64;
 
 	TGAImage();
 	TGAImage(int w, int h, int bpp);
 	TGAImage(const TGAImage &img);
+	// img is left empty. noexcept, so std::vector moves images when it grows instead of copying them.
+	TGAImage(TGAImage &&img) noexcept;
+	// false (and the image empty) when the file can't be read completely.
 	bool read_tga_file(const char *filename);
 	bool write_tga_file(const char *filename, bool rle = true);
 	bool flip_horizontally();
 	bool flip_vertically();
 	bool scale(int w, int h);
+	// checked access to one pixel: out of the image (or no image) gets black and sets nothing.
 	TGAColor get(int x, int y);
 	bool set(int x, int y, TGAColor &c);
 	bool set(int x, int y, const TGAColor &c);
 	~TGAImage();
 	TGAImage & operator =(const TGAImage &img);
-	int get_width();
-	int get_height();
-	int get_bytespp();
+	TGAImage & operator =(TGAImage &&img) noexcept;
+	void swap(TGAImage &img) noexcept;
+	// w x h black pixels of bpp bytes, in the current buffer when it is big enough. false (and empty) for a bad size.
+	bool resize(int w, int h, int bpp);
+	int get_width() const;
+	int get_height() const;
+	int get_bytespp() const;
 	unsigned char *buffer();
+	const unsigned char *buffer() const;
 	void clear();
+
+	// unchecked access for loops over many pixels. row y is get_width() pixels, row_bytes() bytes.
+	int row_bytes() const { return width*bytespp; }
+	unsigned char *row(int y) { return data + (size_t)y*width*bytespp; }
+	const unsigned char *row(int y) const { return data + (size_t)y*width*bytespp; }
+	// typed view of the pixels, empty when pixel isn't the image's format.
+	template <class pixel> ImageView<pixel> view() {
+		return data && pixel::bytespp == bytespp ? ImageView<pixel>(reinterpret_cast<pixel *>(data), width, height) : ImageView<pixel>();
+	}
+	template <class pixel> ImageView<const pixel> view() const {
+		return data && pixel::bytespp == bytespp ? ImageView<const pixel>(reinterpret_cast<const pixel *>(data), width, height) : ImageView<const pixel>();
+	}
 };
 
 #endif //__IMAGE_H__
\ No newline at end of file